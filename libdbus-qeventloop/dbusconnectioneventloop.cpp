@@ -19,34 +19,446 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
 USA.
 *************************************************************************/
 
+#include <QAtomicInt>
 #include <QCoreApplication>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
 #include <QSocketNotifier>
+#include <QThread>
+#include <QThreadStorage>
 #include <QTimer>
 #include <QTimerEvent>
+#include <QVarLengthArray>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "dbusconnectioneventloop.h"
 
-Q_GLOBAL_STATIC(DBUSConnectionEventLoop, classInstance);
+// Readiness events collected from the epoll instance per wakeup.
+static const int MaxEpollEvents = 32;
+
+/**
+ * Socket notifier that knows the watch it was created for, so a
+ * notification needs no lookup by file descriptor.
+ */
+class DBUSConnectionEventLoop::WatchNotifier : public QSocketNotifier
+{
+public:
+    WatchNotifier(Watcher *watcher, Type type, QObject *parent)
+        : QSocketNotifier(watcher->fd, type, parent), watcher(watcher) {}
+
+    Watcher *watcher;
+};
+
+typedef QHash<DBusConnection*, DBUSConnectionEventLoop*> Registry;
+
+// One loop per thread, created on first use and deleted when the thread exits.
+Q_GLOBAL_STATIC(QThreadStorage<DBUSConnectionEventLoop *>, threadLoops);
+
+// Every registered connection and the loop servicing it.
+Q_GLOBAL_STATIC(Registry, registry);
+static QMutex registryMutex;
+
+// Connections of exited threads on their way to the application thread,
+// guarded by registryMutex. Removing one cancels the hand-over.
+Q_GLOBAL_STATIC(QSet<DBusConnection*>, orphans);
+
+/**
+ * Carries a connection of an exited thread to the application thread, with
+ * a reference held on the way.
+ */
+class AdoptConnectionEvent : public QEvent
+{
+public:
+    AdoptConnectionEvent(DBusConnection *conn) : QEvent(QEvent::User), conn(conn)
+    {
+        dbus_connection_ref(conn);
+    }
+    ~AdoptConnectionEvent()
+    {
+        dbus_connection_unref(conn);
+    }
+
+    DBusConnection *conn;
+};
+
+/**
+ * Lives in the application thread and adds the connections handed over to
+ * that thread's loop.
+ */
+class ConnectionAdopter : public QObject
+{
+protected:
+    bool event(QEvent *e)
+    {
+        if (e->type() != QEvent::User)
+            return QObject::event(e);
+
+        DBusConnection *conn = static_cast<AdoptConnectionEvent *>(e)->conn;
+        QMutexLocker locker(&registryMutex);
+        bool adopt = orphans()->remove(conn);
+        locker.unlock();
+
+        if (adopt)
+            DBUSConnectionEventLoop::addConnection(conn);
+        return true;
+    }
+};
+
+// Created by the first loop to hand over connections, never deleted.
+static ConnectionAdopter *adopter = NULL;
+
+// Backend of loops created from now on, -1 until set by the application.
+static QAtomicInt defaultBackend(-1);
+
+// Dispatch budget of loops created from now on, -1 until set by the application.
+static QAtomicInt defaultDispatchBudget(-1);
+
+// Low-wakeup mode of loops created from now on, -1 until set by the application.
+static QAtomicInt defaultLowWakeup(-1);
+
+// Timeouts of at least this many milliseconds are rounded to whole seconds
+// in low-wakeup mode, and may then fire up to half a second early.
+static const int VeryCoarseInterval = 1000;
+
+DBUSConnectionEventLoop* DBUSConnectionEventLoop::threadInstance()
+{
+    QThreadStorage<DBUSConnectionEventLoop *> *loops = threadLoops();
+
+    if (!loops->hasLocalData())
+        loops->setLocalData(new DBUSConnectionEventLoop);
+
+    return loops->localData();
+}
 
 bool DBUSConnectionEventLoop::addConnection(DBusConnection* conn)
 {
-    return classInstance()->internalAddConnection(conn);
+    if (conn == NULL) {
+        return false;
+    }
+
+    QMutexLocker locker(&registryMutex);
+
+    // Keep a connection on the loop that serviced it first.
+    if (registry()->contains(conn))
+        return true;
+
+    DBUSConnectionEventLoop *loop = threadInstance();
+    registry()->insert(conn, loop);
+
+    return loop->internalAddConnection(conn);
 }
 
 void DBUSConnectionEventLoop::removeConnection(DBusConnection* conn)
 {
-    classInstance()->internalRemoveConnection(conn);
+    QMutexLocker locker(&registryMutex);
+    orphans()->remove(conn);
+    DBUSConnectionEventLoop *loop = registry()->take(conn);
+    locker.unlock();
+
+    if (!loop)
+        return;
+
+    if (loop->thread() == QThread::currentThread()) {
+        loop->internalRemoveConnection(conn);
+        return;
+    }
+
+    // Notifiers and timers can only be dropped by the thread owning them.
+    // Hold a reference until the owning thread gets to it.
+    dbus_connection_ref(conn);
+
+    QMutexLocker pendingLocker(&loop->pendingMutex);
+    loop->pendingRemoval.append(conn);
+
+    if (loop->currentBackend == ExternalBackend)
+        loop->wakeHost();
+    else
+        QMetaObject::invokeMethod(loop, "processRemovals", Qt::QueuedConnection);
+}
+
+bool DBUSConnectionEventLoop::setBackend(Backend backend)
+{
+    defaultBackend.store(backend);
+
+    return threadInstance()->internalSetBackend(backend);
+}
+
+DBUSConnectionEventLoop::Backend DBUSConnectionEventLoop::backend()
+{
+    return threadInstance()->currentBackend;
+}
+
+int DBUSConnectionEventLoop::pollDescriptor()
+{
+    DBUSConnectionEventLoop *loop = threadInstance();
+
+    if (loop->currentBackend != ExternalBackend)
+        return -1;
+
+    return loop->epollFd;
+}
+
+int DBUSConnectionEventLoop::nextTimeout()
+{
+    DBUSConnectionEventLoop *loop = threadInstance();
+
+    QMutexLocker locker(&loop->pendingMutex);
+    if (loop->dispatchScheduled || loop->syncScheduled || !loop->pendingRemoval.isEmpty())
+        return 0;
+    locker.unlock();
+
+    if (loop->timeouts.isEmpty())
+        return -1;
+
+    qint64 now = loop->clock.elapsed();
+    qint64 next = -1;
+
+    for (Timeouts::const_iterator it = loop->timeouts.constBegin(); it != loop->timeouts.constEnd(); ++it) {
+        qint64 remaining = qMax(Q_INT64_C(0), it.value()->expiry - now);
+        if (next < 0 || remaining < next)
+            next = remaining;
+    }
+
+    return int(next);
+}
+
+void DBUSConnectionEventLoop::processEvents()
+{
+    DBUSConnectionEventLoop *loop = threadInstance();
+
+    if (loop->currentBackend != ExternalBackend)
+        return;
+
+    loop->processRemovals();
+    loop->syncPending();
+    loop->epollReady();
+
+    // Expire due timeouts. Handlers may add and remove timeouts.
+    qint64 now = loop->clock.elapsed();
+    QVarLengthArray<int, 16> due;
+
+    for (Timeouts::const_iterator it = loop->timeouts.constBegin(); it != loop->timeouts.constEnd(); ++it) {
+        if (it.value()->expiry <= now)
+            due.append(it.key());
+    }
+
+    for (int i = 0; i < due.size(); ++i)
+        loop->handleTimer(due.at(i));
+
+    loop->dispatch();
+}
+
+void DBUSConnectionEventLoop::setDispatchBudget(int messages)
+{
+    if (messages < 0)
+        messages = 0;
+
+    defaultDispatchBudget.store(messages);
+    threadInstance()->budget = messages;
+}
+
+int DBUSConnectionEventLoop::dispatchBudget()
+{
+    return threadInstance()->budget;
+}
+
+void DBUSConnectionEventLoop::setLowWakeupMode(bool enabled)
+{
+    defaultLowWakeup.store(enabled);
+    threadInstance()->lowWakeup = enabled;
+}
+
+bool DBUSConnectionEventLoop::lowWakeupMode()
+{
+    return threadInstance()->lowWakeup;
+}
+
+qint64 DBUSConnectionEventLoop::longestDispatchSlice()
+{
+    return threadInstance()->stats.longestDispatchSlice;
+}
+
+quint64 DBUSConnectionEventLoop::dispatchPasses()
+{
+    return threadInstance()->stats.dispatchPasses;
+}
+
+quint64 DBUSConnectionEventLoop::wakeups()
+{
+    DBUSConnectionEventLoop *loop = threadInstance();
+    QMutexLocker locker(&loop->pendingMutex);
+
+    return loop->stats.wakeups;
+}
+
+DBUSConnectionEventLoop::Statistics::Statistics()
+    : readEvents(0), writeEvents(0), dispatchPasses(0), messagesDispatched(0),
+      wakeups(0), watches(0), enabledWatches(0), timeouts(0), armedTimeouts(0),
+      longestDispatchSlice(0)
+{
+    for (int i = 0; i < HistogramBuckets; ++i)
+        dispatchTime[i] = 0;
+}
+
+DBUSConnectionEventLoop::Statistics DBUSConnectionEventLoop::statistics()
+{
+    DBUSConnectionEventLoop *loop = threadInstance();
+
+    QMutexLocker locker(&loop->pendingMutex);
+    Statistics result = loop->stats;
+
+    result.watches = loop->watchers.size();
+    result.enabledWatches = 0;
+    for (Watchers::const_iterator it = loop->watchers.constBegin(); it != loop->watchers.constEnd(); ++it) {
+        if (it.value()->enabled)
+            ++result.enabledWatches;
+    }
+    locker.unlock();
+
+    result.armedTimeouts = loop->timeouts.size();
+
+    return result;
+}
+
+void DBUSConnectionEventLoop::resetStatistics()
+{
+    DBUSConnectionEventLoop *loop = threadInstance();
+    QMutexLocker locker(&loop->pendingMutex);
+
+    int timeouts = loop->stats.timeouts;
+    loop->stats = Statistics();
+    loop->stats.timeouts = timeouts;
 }
 
-DBUSConnectionEventLoop::DBUSConnectionEventLoop() : QObject()
+DBUSConnectionEventLoop::DBUSConnectionEventLoop() : QObject(),
+    currentBackend(SocketNotifierBackend), epollFd(-1), epollNotifier(0), wakeFd(-1),
+    externalTimerId(0),
+    dispatchScheduled(false), syncScheduled(false), budget(0), lowWakeup(false)
 {
     MYDEBUG();
+
+    clock.start();
+
+    budget = defaultDispatchBudget.load();
+    if (budget < 0)
+        budget = qMax(0, qgetenv("DBUS_QEVENTLOOP_DISPATCH_BUDGET").toInt());
+
+    int lowWakeupDefault = defaultLowWakeup.load();
+    if (lowWakeupDefault < 0)
+        lowWakeup = qgetenv("DBUS_QEVENTLOOP_LOW_WAKEUP") == "1";
+    else
+        lowWakeup = lowWakeupDefault;
+
+    int backend = defaultBackend.load();
+
+    if (backend < 0 && qgetenv("DBUS_QEVENTLOOP_BACKEND") == "epoll")
+        backend = EpollBackend;
+
+    if (backend > 0)
+        internalSetBackend(static_cast<Backend>(backend));
 }
 
 DBUSConnectionEventLoop::~DBUSConnectionEventLoop()
 {
     MYDEBUG();
+
+    // The thread is exiting. Its connections are handed over to the
+    // application thread, unless that is the thread exiting.
+    QCoreApplication *app = QCoreApplication::instance();
+    bool handOver = app != NULL && app->thread() != QThread::currentThread();
+
+    QMutexLocker locker(&registryMutex);
+    if (!registry.isDestroyed()) {
+        for (Connections::const_iterator it = connections.constBegin(); it != connections.constEnd(); ++it) {
+            // Skip connections already removed by other threads.
+            if (registry()->value(*it) != this)
+                continue;
+            registry()->remove(*it);
+            if (handOver)
+                orphans()->insert(*it);
+        }
+    }
+    if (handOver && adopter == NULL) {
+        adopter = new ConnectionAdopter;
+        adopter->moveToThread(app->thread());
+    }
+    locker.unlock();
+
+    // Only once this loop has let go of the connections may the
+    // application thread take them.
+    Connections orphaned = handOver ? connections : Connections();
     cleanup();
+    processRemovals();
+    syncPending();
+
+    for (Connections::const_iterator it = orphaned.constBegin(); it != orphaned.constEnd(); ++it)
+        QCoreApplication::postEvent(adopter, new AdoptConnectionEvent(*it));
+
+    delete epollNotifier;
+    if (epollFd >= 0)
+        close(epollFd);
+    if (wakeFd >= 0)
+        close(wakeFd);
+}
+
+bool DBUSConnectionEventLoop::internalSetBackend(Backend backend)
+{
+    MYDEBUG();
+
+    if (backend == currentBackend)
+        return true;
+
+    // Watches are bound to the backend they were added with.
+    if (!connections.isEmpty())
+        return false;
+
+    if (backend != SocketNotifierBackend && epollFd < 0) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            MYDEBUGC("epoll_create1 failed, keeping the current backend");
+            return false;
+        }
+    }
+
+    // The host is woken through an eventfd in the epoll set when a
+    // dispatch pass is due.
+    if (backend == ExternalBackend && wakeFd < 0) {
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wakeFd < 0) {
+            MYDEBUGC("eventfd failed, keeping the current backend");
+            return false;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = 0;
+        event.data.fd = wakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    }
+
+    if (backend == EpollBackend && !epollNotifier) {
+        epollNotifier = new QSocketNotifier(epollFd, QSocketNotifier::Read, this);
+        connect(epollNotifier, SIGNAL(activated(int)), SLOT(epollReady()));
+    }
+
+    if (epollNotifier)
+        epollNotifier->setEnabled(backend == EpollBackend);
+
+    currentBackend = backend;
+    return true;
+}
+
+// Make the external host's poll on the epoll instance return.
+void DBUSConnectionEventLoop::wakeHost()
+{
+    quint64 one = 1;
+
+    if (write(wakeFd, &one, sizeof(one)) < 0)
+        MYDEBUGC("Waking the host failed");
 }
 
 void DBUSConnectionEventLoop::cleanup()
@@ -60,56 +472,366 @@ void DBUSConnectionEventLoop::cleanup()
         dbus_connection_set_watch_functions(*it, NULL, NULL, NULL, NULL, NULL);
         dbus_connection_set_timeout_functions(*it, NULL, NULL, NULL, NULL, NULL);
         dbus_connection_set_wakeup_main_function(*it, NULL, NULL, NULL);
+        dbus_connection_set_dispatch_status_function(*it, NULL, NULL, NULL);
     }
 }
 
 // Handle a socket being ready to read.
-void DBUSConnectionEventLoop::readSocket(int fd)
+void DBUSConnectionEventLoop::readSocket(int)
 {
     MYDEBUG();
 
-    Watchers::const_iterator it = watchers.find(fd);
-
-    while (it != watchers.end() && it.key() == fd) {
-        const Watcher &watcher = it.value();
+    WatchNotifier *notifier = static_cast<WatchNotifier *>(sender());
+    DBusWatch *watch = NULL;
 
-        if (watcher.read && watcher.read->isEnabled()) {
-            dbus_watch_handle(watcher.watch, DBUS_WATCH_READABLE);
-            break;
-        }
+    if (notifier) {
+        QMutexLocker locker(&pendingMutex);
+        if (notifier->watcher->enabled)
+            watch = notifier->watcher->watch;
+    }
 
-        ++it;
+    if (watch) {
+        ++stats.readEvents;
+        dbus_watch_handle(watch, DBUS_WATCH_READABLE);
     }
 
     dispatch();
 }
 
 // Handle a socket being ready to write.
-void DBUSConnectionEventLoop::writeSocket(int fd)
+void DBUSConnectionEventLoop::writeSocket(int)
 {
     MYDEBUG();
 
-    Watchers::const_iterator it = watchers.find(fd);
+    WatchNotifier *notifier = static_cast<WatchNotifier *>(sender());
+    DBusWatch *watch = NULL;
+
+    if (notifier) {
+        QMutexLocker locker(&pendingMutex);
+        if (notifier->watcher->enabled)
+            watch = notifier->watcher->watch;
+    }
+
+    if (watch) {
+        ++stats.writeEvents;
+        dbus_watch_handle(watch, DBUS_WATCH_WRITABLE);
+    }
+}
+
+// Handle readiness of any number of watches reported by the epoll instance.
+void DBUSConnectionEventLoop::epollReady()
+{
+    MYDEBUG();
+
+    struct epoll_event events[MaxEpollEvents];
+    int count = epoll_wait(epollFd, events, MaxEpollEvents, 0);
+
+    if (count <= 0)
+        return;
+
+    struct ReadyWatch {
+        int fd;
+        DBusWatch *watch;
+        unsigned int condition;
+    };
+    QVarLengthArray<ReadyWatch, MaxEpollEvents * 2> ready;
+
+    // Collect first, handling a watch may add or remove other watches.
+    QMutexLocker locker(&pendingMutex);
 
-    while (it != watchers.end() && it.key() == fd) {
-        const Watcher &watcher = it.value();
+    for (int i = 0; i < count; ++i) {
+        int fd = events[i].data.fd;
+        quint32 revents = events[i].events;
 
-        if (watcher.write && watcher.write->isEnabled()) {
-            dbus_watch_handle(watcher.watch, DBUS_WATCH_WRITABLE);
-            break;
+        if (fd == wakeFd) {
+            quint64 count;
+            if (read(wakeFd, &count, sizeof(count)) < 0)
+                MYDEBUGC("Clearing the host wakeup failed");
+            continue;
         }
 
+        Watchers::const_iterator it = watchers.constFind(fd);
+        while (it != watchers.constEnd() && it.key() == fd) {
+            const Watcher *watcher = it.value();
+
+            if (watcher->enabled && watcher->watch) {
+                unsigned int condition = 0;
+
+                if ((watcher->flags & DBUS_WATCH_READABLE) && (revents & EPOLLIN))
+                    condition |= DBUS_WATCH_READABLE;
+                if ((watcher->flags & DBUS_WATCH_WRITABLE) && (revents & EPOLLOUT))
+                    condition |= DBUS_WATCH_WRITABLE;
+                if (revents & EPOLLERR)
+                    condition |= DBUS_WATCH_ERROR;
+                if (revents & EPOLLHUP)
+                    condition |= DBUS_WATCH_HANGUP;
+
+                if (condition) {
+                    ReadyWatch r = { fd, watcher->watch, condition };
+                    ready.append(r);
+                }
+            }
+
+            ++it;
+        }
+    }
+
+    locker.unlock();
+
+    // Skip watches removed meanwhile, they may have been freed already.
+    for (int i = 0; i < ready.size(); ++i) {
+        const ReadyWatch &r = ready.at(i);
+        bool handle = false;
+
+        locker.relock();
+        Watchers::const_iterator it = watchers.constFind(r.fd);
+        while (it != watchers.constEnd() && it.key() == r.fd) {
+            if (it.value()->watch == r.watch) {
+                handle = it.value()->enabled;
+                break;
+            }
+            ++it;
+        }
+        locker.unlock();
+
+        if (handle) {
+            if (r.condition & DBUS_WATCH_READABLE)
+                ++stats.readEvents;
+            if (r.condition & DBUS_WATCH_WRITABLE)
+                ++stats.writeEvents;
+            dbus_watch_handle(r.watch, r.condition);
+        }
+    }
+
+    dispatch();
+}
+
+// Register the union of the enabled watches on fd with the epoll instance.
+void DBUSConnectionEventLoop::updateEpoll(int fd)
+{
+    MYDEBUG();
+
+    quint32 events = 0;
+
+    QMutexLocker locker(&pendingMutex);
+    Watchers::const_iterator it = watchers.constFind(fd);
+    while (it != watchers.constEnd() && it.key() == fd) {
+        const Watcher *watcher = it.value();
+
+        if (watcher->enabled && watcher->watch) {
+            if (watcher->flags & DBUS_WATCH_READABLE)
+                events |= EPOLLIN;
+            if (watcher->flags & DBUS_WATCH_WRITABLE)
+                events |= EPOLLOUT;
+        }
         ++it;
     }
+    locker.unlock();
+
+    QHash<int, quint32>::iterator registered = epollEvents.find(fd);
+
+    if (events == 0) {
+        if (registered != epollEvents.end()) {
+            // Fails harmlessly with EBADF if libdbus closed the fd already.
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+            epollEvents.erase(registered);
+        }
+        return;
+    }
+
+    if (registered != epollEvents.end() && registered.value() == events)
+        return;
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = 0;
+    event.data.fd = fd;
+
+    int op = (registered != epollEvents.end()) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epollFd, op, fd, &event) < 0 && op == EPOLL_CTL_MOD) {
+        // The fd was closed and reused behind our back, register it anew.
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+    epollEvents[fd] = events;
+}
+
+// Drop connections removed from other threads.
+void DBUSConnectionEventLoop::processRemovals()
+{
+    MYDEBUG();
+
+    QMutexLocker locker(&pendingMutex);
+    Connections removed;
+    removed.swap(pendingRemoval);
+    locker.unlock();
+
+    foreach (DBusConnection *conn, removed) {
+        internalRemoveConnection(conn);
+        dbus_connection_unref(conn);
+    }
 }
 
+// Apply watch and timeout changes made by other threads.
+void DBUSConnectionEventLoop::syncPending()
+{
+    MYDEBUG();
+
+    QMutexLocker locker(&pendingMutex);
+    QList<Watcher *> added, changed, removed;
+    added.swap(addedWatchers);
+    changed.swap(changedWatchers);
+    removed.swap(removedWatchers);
+    QList<Timeout *> toggled, expired;
+    toggled.swap(changedTimeouts);
+    expired.swap(removedTimeouts);
+    syncScheduled = false;
+    locker.unlock();
+
+    foreach (Watcher *watcher, added) {
+        if (!removed.contains(watcher))
+            attachWatcher(watcher);
+    }
+
+    foreach (Watcher *watcher, changed) {
+        if (!added.contains(watcher) && !removed.contains(watcher))
+            applyWatcher(watcher);
+    }
+
+    foreach (Watcher *watcher, removed) {
+        if (!added.contains(watcher))
+            detachWatcher(watcher);
+        delete watcher;
+    }
+
+    foreach (Timeout *t, toggled) {
+        if (expired.contains(t))
+            continue;
+
+        locker.relock();
+        bool enabled = t->enabled;
+        locker.unlock();
+
+        if (enabled)
+            armTimeout(t);
+        else
+            disarmTimeout(t);
+    }
+
+    foreach (Timeout *t, expired) {
+        disarmTimeout(t);
+        delete t;
+    }
+}
+
+// Dispatch the connections that reported queued incoming messages.
 void DBUSConnectionEventLoop::dispatch()
 {
     MYDEBUG();
 
-    for (Connections::const_iterator it = connections.constBegin(); it != connections.constEnd(); ++it)
-        while (dbus_connection_dispatch(*it) == DBUS_DISPATCH_DATA_REMAINS)
-            ;
+    QMutexLocker locker(&pendingMutex);
+    Connections pending;
+    pending.swap(pendingDispatch);
+    dispatchScheduled = false;
+    locker.unlock();
+
+    if (pending.isEmpty())
+        return;
+
+    ++stats.dispatchPasses;
+
+    qint64 start = clock.nsecsElapsed();
+    int dispatched = 0;
+
+    // One message per connection in turn, so a busy connection cannot
+    // starve the others. Handlers may add or remove connections, or queue
+    // more messages.
+    while (!pending.isEmpty() && (budget == 0 || dispatched < budget)) {
+        DBusConnection *conn = pending.takeFirst();
+
+        if (!connections.contains(conn))
+            continue;
+
+        if (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
+            pending.append(conn);
+
+        ++dispatched;
+    }
+
+    stats.messagesDispatched += dispatched;
+
+    // Budget used up, yield to the event loop and continue where we left
+    // off, ahead of connections that reported data meanwhile.
+    if (!pending.isEmpty()) {
+        locker.relock();
+
+        foreach (DBusConnection *conn, pendingDispatch) {
+            if (!pending.contains(conn))
+                pending.append(conn);
+        }
+        pendingDispatch.swap(pending);
+
+        scheduleDispatch();
+        locker.unlock();
+    }
+
+    qint64 slice = (clock.nsecsElapsed() - start) / 1000;
+    if (slice > stats.longestDispatchSlice)
+        stats.longestDispatchSlice = slice;
+
+    int bucket = 0;
+    for (qint64 limit = 10; slice >= limit && bucket < Statistics::HistogramBuckets - 1; limit *= 10)
+        ++bucket;
+    ++stats.dispatchTime[bucket];
+}
+
+// Have the owning thread pick up watch and timeout changes, however often
+// they are made. Called with pendingMutex held from another thread.
+void DBUSConnectionEventLoop::scheduleSync()
+{
+    if (syncScheduled)
+        return;
+
+    syncScheduled = true;
+
+    if (currentBackend == ExternalBackend)
+        wakeHost();
+    else
+        QMetaObject::invokeMethod(this, "syncPending", Qt::QueuedConnection);
+}
+
+// Run one dispatch pass from the event loop, however often it is requested.
+// Called with pendingMutex held, possibly from another thread.
+void DBUSConnectionEventLoop::scheduleDispatch()
+{
+    if (dispatchScheduled)
+        return;
+
+    dispatchScheduled = true;
+
+    if (currentBackend == ExternalBackend)
+        wakeHost();
+    else
+        QMetaObject::invokeMethod(this, "dispatch", Qt::QueuedConnection);
+}
+
+void DBUSConnectionEventLoop::dispatchStatusChanged(DBusConnection *conn,
+                                                    DBusDispatchStatus status,
+                                                    void *data)
+{
+    MYDEBUG();
+
+    if (status != DBUS_DISPATCH_DATA_REMAINS)
+        return;
+
+    DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
+
+    // libdbus must not be re-entered from here, dispatch later.
+    QMutexLocker locker(&loop->pendingMutex);
+
+    if (!loop->pendingDispatch.contains(conn))
+        loop->pendingDispatch.append(conn);
+
+    loop->scheduleDispatch();
 }
 
 // Handle timer events.
@@ -118,38 +840,210 @@ void DBUSConnectionEventLoop::timerEvent(QTimerEvent *e)
     MYDEBUG();
     MYDEBUGC("TimerID: %d", e->timerId());
 
-    DBusTimeout *timeout = timeouts.value(e->timerId());
+    handleTimer(e->timerId());
+}
+
+// Handle the expiry of a timer, a Qt one or, with ExternalBackend, one
+// checked by processEvents().
+void DBUSConnectionEventLoop::handleTimer(int timerId)
+{
+    Timeout *t = timeouts.value(timerId);
+
+    if (!t)
+        return;
+
+    qint64 now = clock.elapsed();
+
+    // Re-armed after the timer was started, wait for the remainder. Qt
+    // may fire coarse timers slightly early, tolerate that.
+    int slack = t->interval / 20;
+    if (lowWakeup && t->interval >= VeryCoarseInterval)
+        slack = VeryCoarseInterval / 2;
+
+    if (t->deadline - now > slack) {
+        startTimeoutTimer(t, t->deadline - now, now);
+        return;
+    }
 
+    // libdbus timeouts repeat until disabled or removed.
+    t->deadline = now + t->interval;
+    if (t->period != t->interval)
+        startTimeoutTimer(t, t->interval, now);
+    else
+        t->expiry = now + t->period;
+
+    QMutexLocker locker(&pendingMutex);
+    DBusTimeout *timeout = t->enabled ? t->timeout : NULL;
+    locker.unlock();
+
+    // Handling may remove the timeout and delete t.
     if (timeout)
         dbus_timeout_handle(timeout);
+    dispatch();
+}
+
+// Start the Qt timer of t, replacing the running one if any. With
+// ExternalBackend only the expiry is recorded, under a made up timer id.
+bool DBUSConnectionEventLoop::startTimeoutTimer(Timeout *t, int interval, qint64 now)
+{
+    if (t->timerId) {
+        if (currentBackend != ExternalBackend)
+            killTimer(t->timerId);
+        timeouts.remove(t->timerId);
+    }
+
+    if (currentBackend == ExternalBackend) {
+        if (++externalTimerId == 0)
+            ++externalTimerId;
+
+        t->timerId = externalTimerId;
+        t->period = interval;
+        t->expiry = now + interval;
+        timeouts.insert(t->timerId, t);
+
+        return true;
+    }
+
+    // In low-wakeup mode long timeouts, typically method call timeouts that
+    // hardly ever expire, are coalesced with other timers of the system.
+    Qt::TimerType type = Qt::CoarseTimer;
+    if (lowWakeup && interval >= VeryCoarseInterval)
+        type = Qt::VeryCoarseTimer;
+
+    t->timerId = startTimer(interval, type);
+    t->period = interval;
+    t->expiry = now + interval;
+
+    MYDEBUGC("Started timer %d with interval %d!", t->timerId, interval);
+
+    if (!t->timerId)
+        return false;
+
+    timeouts.insert(t->timerId, t);
+
+    return true;
+}
+
+// Arm t for its full interval from now. A running timer that expires no
+// later than the new deadline is kept and re-armed when it fires, so
+// toggling a timeout repeatedly costs no timer registration.
+bool DBUSConnectionEventLoop::armTimeout(Timeout *t)
+{
+    // Pretend it is successful if there is no application instance.
+    if (!QCoreApplication::instance() && currentBackend != ExternalBackend)
+        return true;
+
+    qint64 now = clock.elapsed();
+
+    QMutexLocker locker(&pendingMutex);
+    t->interval = t->requested;
+    locker.unlock();
+
+    t->deadline = now + t->interval;
+
+    if (t->timerId && t->expiry <= t->deadline)
+        return true;
+
+    return startTimeoutTimer(t, t->interval, now);
+}
+
+void DBUSConnectionEventLoop::disarmTimeout(Timeout *t)
+{
+    if (!t->timerId)
+        return;
+
+    if (currentBackend != ExternalBackend)
+        killTimer(t->timerId);
+    timeouts.remove(t->timerId);
+    t->timerId = 0;
 }
 
+// Hook a watch up to the notifiers or the epoll set. Owning thread only.
+void DBUSConnectionEventLoop::attachWatcher(Watcher *watcher)
+{
+    watchers.insertMulti(watcher->fd, watcher);
+
+    if (currentBackend != SocketNotifierBackend) {
+        updateEpoll(watcher->fd);
+        return;
+    }
+
+    QMutexLocker locker(&pendingMutex);
+    bool enabled = watcher->enabled;
+    locker.unlock();
+
+    if (watcher->flags & DBUS_WATCH_READABLE) {
+        watcher->read = new WatchNotifier(watcher, QSocketNotifier::Read, this);
+        watcher->read->setEnabled(enabled);
+        connect(watcher->read, SIGNAL(activated(int)), SLOT(readSocket(int)));
+    }
+
+    if (watcher->flags & DBUS_WATCH_WRITABLE) {
+        watcher->write = new WatchNotifier(watcher, QSocketNotifier::Write, this);
+        watcher->write->setEnabled(enabled);
+        connect(watcher->write, SIGNAL(activated(int)), SLOT(writeSocket(int)));
+    }
+}
+
+// Follow the enabled state of an attached watch. Owning thread only.
+void DBUSConnectionEventLoop::applyWatcher(Watcher *watcher)
+{
+    if (currentBackend != SocketNotifierBackend) {
+        updateEpoll(watcher->fd);
+        return;
+    }
+
+    QMutexLocker locker(&pendingMutex);
+    bool enabled = watcher->enabled;
+    locker.unlock();
+
+    if (watcher->read)
+        watcher->read->setEnabled(enabled);
+
+    if (watcher->write)
+        watcher->write->setEnabled(enabled);
+}
+
+// Unhook an attached watch, the caller deletes it. Owning thread only.
+void DBUSConnectionEventLoop::detachWatcher(Watcher *watcher)
+{
+    watchers.remove(watcher->fd, watcher);
+
+    if (currentBackend != SocketNotifierBackend)
+        updateEpoll(watcher->fd);
+
+    delete watcher->read;
+    delete watcher->write;
+    watcher->read = 0;
+    watcher->write = 0;
+}
+
+// libdbus adds, toggles and removes watches and timeouts from whichever
+// thread touches the connection. Notifiers, the epoll set and timers belong
+// to the owning thread, which other threads leave the changes to.
+
 dbus_bool_t DBUSConnectionEventLoop::addWatch(DBusWatch *watch, void *data)
 {
     MYDEBUG();
 
     DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
 
-    int fd = dbus_watch_get_unix_fd(watch);
-    unsigned int flags = dbus_watch_get_flags(watch);
-    dbus_bool_t enabled = dbus_watch_get_enabled(watch);
+    DBUSConnectionEventLoop::Watcher *watcher = new DBUSConnectionEventLoop::Watcher;
+    watcher->watch = watch;
+    watcher->fd = dbus_watch_get_unix_fd(watch);
+    watcher->flags = dbus_watch_get_flags(watch);
+    watcher->enabled = dbus_watch_get_enabled(watch);
 
-    DBUSConnectionEventLoop::Watcher watcher;
-    watcher.watch = watch;
+    dbus_watch_set_data(watch, watcher, NULL);
 
-    if (flags & DBUS_WATCH_READABLE) {
-        watcher.read = new QSocketNotifier(fd, QSocketNotifier::Read, loop);
-        watcher.read->setEnabled(enabled);
-        loop->connect(watcher.read, SIGNAL(activated(int)), SLOT(readSocket(int)));
-    }
-
-    if (flags & DBUS_WATCH_WRITABLE) {
-        watcher.write = new QSocketNotifier(fd, QSocketNotifier::Write, loop);
-        watcher.write->setEnabled(enabled);
-        loop->connect(watcher.write, SIGNAL(activated(int)), SLOT(writeSocket(int)));
+    if (loop->thread() != QThread::currentThread()) {
+        QMutexLocker locker(&loop->pendingMutex);
+        loop->addedWatchers.append(watcher);
+        loop->scheduleSync();
+        return true;
     }
 
-    loop->watchers.insertMulti(fd, watcher);
+    loop->attachWatcher(watcher);
 
     return true;
 }
@@ -159,29 +1053,32 @@ void DBUSConnectionEventLoop::removeWatch(DBusWatch *watch, void *data)
     MYDEBUG();
 
     DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
+    DBUSConnectionEventLoop::Watcher *watcher =
+        reinterpret_cast<DBUSConnectionEventLoop::Watcher *>(dbus_watch_get_data(watch));
 
-    int fd = dbus_watch_get_unix_fd(watch);
-
-    DBUSConnectionEventLoop::Watchers::iterator it = loop->watchers.find(fd);
+    if (!watcher)
+        return;
 
-    while (it != loop->watchers.end() && it.key() == fd) {
-        DBUSConnectionEventLoop::Watcher &watcher = it.value();
+    dbus_watch_set_data(watch, NULL, NULL);
 
-        if (watcher.watch == watch) {
-            if (watcher.read) {
-                delete watcher.read;
-            }
-            if (watcher.write) {
-                delete watcher.write;
-            }
+    // libdbus may free the watch as soon as we return.
+    QMutexLocker locker(&loop->pendingMutex);
+    watcher->watch = NULL;
 
-            loop->watchers.erase(it);
+    if (loop->thread() != QThread::currentThread()) {
+        loop->removedWatchers.append(watcher);
+        loop->scheduleSync();
+        return;
+    }
 
-            return;
-        }
+    // Added from another thread and never attached.
+    bool attached = !loop->addedWatchers.removeOne(watcher);
+    loop->changedWatchers.removeOne(watcher);
+    locker.unlock();
 
-        ++it;
-    }
+    if (attached)
+        loop->detachWatcher(watcher);
+    delete watcher;
 }
 
 void DBUSConnectionEventLoop::toggleWatch(DBusWatch *watch, void *data)
@@ -189,53 +1086,65 @@ void DBUSConnectionEventLoop::toggleWatch(DBusWatch *watch, void *data)
     MYDEBUG();
 
     DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop*>(data);
+    DBUSConnectionEventLoop::Watcher *watcher =
+        reinterpret_cast<DBUSConnectionEventLoop::Watcher *>(dbus_watch_get_data(watch));
 
-    int fd = dbus_watch_get_unix_fd(watch);
-    unsigned int flags = dbus_watch_get_flags(watch);
-    dbus_bool_t enabled = dbus_watch_get_enabled(watch);
-
-    DBUSConnectionEventLoop::Watchers::const_iterator it = loop->watchers.find(fd);
+    if (!watcher)
+        return;
 
-    while (it != loop->watchers.end() && it.key() == fd) {
-        const DBUSConnectionEventLoop::Watcher &watcher = it.value();
+    QMutexLocker locker(&loop->pendingMutex);
+    watcher->enabled = dbus_watch_get_enabled(watch);
 
-        if (watcher.watch == watch) {
-            if (flags & DBUS_WATCH_READABLE && watcher.read)
-                watcher.read->setEnabled(enabled);
-
-            if (flags & DBUS_WATCH_WRITABLE && watcher.write)
-                watcher.write->setEnabled(enabled);
+    if (loop->thread() != QThread::currentThread()) {
+        if (!loop->changedWatchers.contains(watcher))
+            loop->changedWatchers.append(watcher);
+        loop->scheduleSync();
+        return;
+    }
 
-            return;
-        }
+    bool attached = !loop->addedWatchers.removeOne(watcher);
+    loop->changedWatchers.removeOne(watcher);
+    locker.unlock();
 
-        ++it;
-    }
+    if (attached)
+        loop->applyWatcher(watcher);
+    else
+        loop->attachWatcher(watcher);
 }
 
 dbus_bool_t DBUSConnectionEventLoop::addTimeout(DBusTimeout *timeout, void *data)
 {
     MYDEBUG();
 
-    // Nothing to do if the timeout is disabled.
-    if (!dbus_timeout_get_enabled(timeout))
-        return true;
-
-    // Pretend it is successful if there is no application instance.
-    if (!QCoreApplication::instance())
-        return true;
-
     DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
 
-    int timerInterval = dbus_timeout_get_interval(timeout);
-    int id = loop->startTimer(timerInterval);
+    DBUSConnectionEventLoop::Timeout *t = new DBUSConnectionEventLoop::Timeout;
+    t->timeout = timeout;
+    t->enabled = dbus_timeout_get_enabled(timeout);
+    t->requested = dbus_timeout_get_interval(timeout);
 
-    MYDEBUGC("Adding timeout %d with interval %d!", id, timerInterval);
+    if (loop->thread() != QThread::currentThread()) {
+        dbus_timeout_set_data(timeout, t, NULL);
 
-    if (!id)
+        QMutexLocker locker(&loop->pendingMutex);
+        ++loop->stats.timeouts;
+        if (t->enabled) {
+            loop->changedTimeouts.append(t);
+            loop->scheduleSync();
+        }
+        return true;
+    }
+
+    // Nothing to arm if the timeout is disabled.
+    if (t->enabled && !loop->armTimeout(t)) {
+        delete t;
         return false;
+    }
+
+    dbus_timeout_set_data(timeout, t, NULL);
 
-    loop->timeouts[id] = timeout;
+    QMutexLocker locker(&loop->pendingMutex);
+    ++loop->stats.timeouts;
 
     return true;
 }
@@ -245,25 +1154,62 @@ void DBUSConnectionEventLoop::removeTimeout(DBusTimeout *timeout, void *data)
     MYDEBUG();
 
     DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
+    DBUSConnectionEventLoop::Timeout *t =
+        reinterpret_cast<DBUSConnectionEventLoop::Timeout *>(dbus_timeout_get_data(timeout));
 
-    DBUSConnectionEventLoop::Timeouts::iterator it = loop->timeouts.begin();
+    if (!t)
+        return;
 
-    while (it != loop->timeouts.end()) {
-        if (it.value() == timeout) {
-            loop->killTimer(it.key());
-            it = loop->timeouts.erase(it);
-        }
-        else
-            ++it;
+    dbus_timeout_set_data(timeout, NULL, NULL);
+
+    // libdbus may free the timeout as soon as we return.
+    QMutexLocker locker(&loop->pendingMutex);
+    t->timeout = NULL;
+    --loop->stats.timeouts;
+
+    if (loop->thread() != QThread::currentThread()) {
+        loop->removedTimeouts.append(t);
+        loop->scheduleSync();
+        return;
     }
+
+    loop->changedTimeouts.removeOne(t);
+    locker.unlock();
+
+    loop->disarmTimeout(t);
+    delete t;
 }
 
 void DBUSConnectionEventLoop::toggleTimeout(DBusTimeout *timeout, void *data)
 {
     MYDEBUG();
 
-    DBUSConnectionEventLoop::removeTimeout(timeout, data);
-    DBUSConnectionEventLoop::addTimeout(timeout, data);
+    DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
+    DBUSConnectionEventLoop::Timeout *t =
+        reinterpret_cast<DBUSConnectionEventLoop::Timeout *>(dbus_timeout_get_data(timeout));
+
+    if (!t)
+        return;
+
+    QMutexLocker locker(&loop->pendingMutex);
+    t->enabled = dbus_timeout_get_enabled(timeout);
+    t->requested = dbus_timeout_get_interval(timeout);
+
+    if (loop->thread() != QThread::currentThread()) {
+        if (!loop->changedTimeouts.contains(t))
+            loop->changedTimeouts.append(t);
+        loop->scheduleSync();
+        return;
+    }
+
+    loop->changedTimeouts.removeOne(t);
+    bool enabled = t->enabled;
+    locker.unlock();
+
+    if (enabled)
+        loop->armTimeout(t);
+    else
+        loop->disarmTimeout(t);
 }
 
 void DBUSConnectionEventLoop::wakeupMain(void *data)
@@ -272,7 +1218,17 @@ void DBUSConnectionEventLoop::wakeupMain(void *data)
 
     DBUSConnectionEventLoop *loop = reinterpret_cast<DBUSConnectionEventLoop *>(data);
 
-    QTimer::singleShot(0, loop, SLOT(dispatch()));
+    // libdbus wakes the loop from whichever thread queued a message.
+    QMutexLocker locker(&loop->pendingMutex);
+
+    ++loop->stats.wakeups;
+
+    // The owning thread is awake already and incoming data is scheduled
+    // through the dispatch status, so only foreign threads need a pass.
+    if (loop->lowWakeup && loop->thread() == QThread::currentThread())
+        return;
+
+    loop->scheduleDispatch();
 }
 
 // The initialization point
@@ -282,10 +1238,6 @@ bool DBUSConnectionEventLoop::internalAddConnection(DBusConnection* conn)
 
     bool rc = true;
 
-    if (conn == NULL) {
-        return false;
-    }
-
     MYDEBUGC("Adding connection %p", conn);
 
     // Check if connection is in list
@@ -323,6 +1275,11 @@ bool DBUSConnectionEventLoop::internalAddConnection(DBusConnection* conn)
     }
 
     dbus_connection_set_wakeup_main_function(conn, DBUSConnectionEventLoop::wakeupMain, this, 0);
+    dbus_connection_set_dispatch_status_function(conn, DBUSConnectionEventLoop::dispatchStatusChanged, this, 0);
+
+    // Messages may have been queued before the connection was handed over.
+    if (dbus_connection_get_dispatch_status(conn) == DBUS_DISPATCH_DATA_REMAINS)
+        dispatchStatusChanged(conn, DBUS_DISPATCH_DATA_REMAINS, this);
 
     return rc;
 }
@@ -337,6 +1294,11 @@ void DBUSConnectionEventLoop::internalRemoveConnection(DBusConnection* conn)
             dbus_connection_set_watch_functions(*it, NULL, NULL, NULL, NULL, NULL);
             dbus_connection_set_timeout_functions(*it, NULL, NULL, NULL, NULL, NULL);
             dbus_connection_set_wakeup_main_function(*it, NULL, NULL, NULL);
+            dbus_connection_set_dispatch_status_function(*it, NULL, NULL, NULL);
+
+            QMutexLocker locker(&pendingMutex);
+            pendingDispatch.removeAll(conn);
+            locker.unlock();
 
             connections.erase(it);
             return;
@@ -26,6 +26,8 @@ USA.
 #include <QList>
 #include <QMultiHash>
 #include <QHash>
+#include <QElapsedTimer>
+#include <QMutex>
 
 #include <dbus/dbus.h>
 
@@ -63,7 +65,13 @@ class QTimerEvent;
 /**
 * This class is handling dbus notifications with QT events. QEventLoop must
 *  be handled in order to handle dbus events.
-* Usage: DBUSConnectionEventLoop myLoop; myLoop.addConnection(bus);
+* Every thread gets its own loop instance; a connection is serviced by the
+*  thread that added it, which must run a QEventLoop. When that thread
+*  exits, the application thread takes the connection over.
+* libdbus may add, toggle and remove watches and timeouts from any thread
+*  using the connection; the owning thread applies such changes to its
+*  notifiers and timers on its next event loop iteration.
+* Usage: DBUSConnectionEventLoop::addConnection(bus);
 */
 class DBUSConnectionEventLoop : public QObject
 {
@@ -72,56 +80,286 @@ private:
     Q_DISABLE_COPY(DBUSConnectionEventLoop)
 
 public:
+    /**
+     * How socket readiness is collected from the Qt event loop.
+     */
+    enum Backend {
+        SocketNotifierBackend = 0,  ///< one QSocketNotifier per watch and direction
+        EpollBackend,               ///< one epoll instance for all watches, one notifier
+        ExternalBackend             ///< driven by a foreign loop, see processEvents()
+    };
+
+    /**
+     * Runtime statistics of one thread's handler.
+     */
+    struct Statistics
+    {
+        enum {
+            /**
+             * Bucket i of dispatchTime counts dispatch passes shorter than
+             * 10^(i+1) microseconds, the last bucket all longer ones.
+             */
+            HistogramBuckets = 6
+        };
+
+        Statistics();
+
+        quint64 readEvents;             ///< read readiness events handled
+        quint64 writeEvents;            ///< write readiness events handled
+        quint64 dispatchPasses;         ///< dispatch passes run
+        quint64 messagesDispatched;     ///< messages dispatched
+        quint64 wakeups;                ///< wakeup requests from libdbus
+        int watches;                    ///< watches registered
+        int enabledWatches;             ///< watches currently enabled
+        int timeouts;                   ///< timeouts registered
+        int armedTimeouts;              ///< timeouts with a running timer
+        qint64 longestDispatchSlice;    ///< longest dispatch pass, in microseconds
+        quint64 dispatchTime[HistogramBuckets];
+    };
+
     DBUSConnectionEventLoop();
     virtual ~DBUSConnectionEventLoop();
 
     /**
-     * Add new dbus connection into handler.
+     * Add new dbus connection into the calling thread's handler. A
+     * connection already added by any thread stays with that thread until
+     * it exits, and then moves to the QCoreApplication thread, which picks
+     * it up in its event loop. Connections of the application thread itself
+     * are dropped when it exits.
      * \return true if everything went well.
      */
     static bool addConnection(DBusConnection* conn);
+
+    /**
+     * Remove a dbus connection, from any thread. The owning thread drops
+     * its watches and timeouts the next time it runs its event loop.
+     */
     static void removeConnection(DBusConnection* conn);
 
+    /**
+     * Select the readiness backend of the calling thread's handler and of
+     * handlers created afterwards. The default is SocketNotifierBackend,
+     * unless DBUS_QEVENTLOOP_BACKEND=epoll is set in the environment.
+     * \return false if the calling thread has connections registered or the
+     * backend is not available; remove all connections before switching.
+     */
+    static bool setBackend(Backend backend);
+    static Backend backend();
+
+    /**
+     * Integration with event loops other than Qt's. After
+     * setBackend(ExternalBackend) the calling thread's handler uses neither
+     * socket notifiers nor Qt timers. The host polls pollDescriptor() for
+     * readability, waiting no longer than nextTimeout() milliseconds, and
+     * then calls processEvents() on the same thread:
+     *
+     *   struct pollfd pfd = { DBUSConnectionEventLoop::pollDescriptor(), POLLIN, 0 };
+     *   poll(&pfd, 1, DBUSConnectionEventLoop::nextTimeout());
+     *   DBUSConnectionEventLoop::processEvents();
+     *
+     * pollDescriptor() is -1 with the other backends. nextTimeout() is -1
+     * if no timeout is armed and 0 if a dispatch pass is due.
+     * processEvents() never blocks.
+     */
+    static int pollDescriptor();
+    static int nextTimeout();
+    static void processEvents();
+
+    /**
+     * Limit the messages dispatched per dispatch pass by the calling
+     * thread's handler and by handlers created afterwards. When the budget
+     * is used up the handler yields to the event loop and continues with
+     * the next connection in turn. A pass runs after each readiness event,
+     * expired timeout and wakeup, so an event loop iteration handling
+     * several of them may dispatch up to the budget for each. 0, the
+     * default unless set with DBUS_QEVENTLOOP_DISPATCH_BUDGET, means no
+     * limit.
+     */
+    static void setDispatchBudget(int messages);
+    static int dispatchBudget();
+
+    /**
+     * Switch the calling thread's handler, and handlers created afterwards,
+     * to the low-wakeup mode. Timeouts of a second or more then use very
+     * coarse timers that the system may coalesce, and wakeups requested
+     * from the handler's own thread do not schedule a dispatch pass. Off by
+     * default unless DBUS_QEVENTLOOP_LOW_WAKEUP=1 is set in the environment.
+     * Timeouts armed before the switch keep their timers until re-armed.
+     */
+    static void setLowWakeupMode(bool enabled);
+    static bool lowWakeupMode();
+
+    /**
+     * Longest single dispatch pass of the calling thread's handler, in
+     * microseconds. Use it to tune the dispatch budget.
+     */
+    static qint64 longestDispatchSlice();
+
+    /**
+     * Number of dispatch passes the calling thread's handler has run. A
+     * pass dispatches only the connections with queued incoming messages.
+     */
+    static quint64 dispatchPasses();
+
+    /**
+     * Number of wakeup requests received from libdbus. Wakeups within one
+     * event loop iteration are collapsed into a single dispatch pass.
+     */
+    static quint64 wakeups();
+
+    /**
+     * Snapshot of the calling thread's handler statistics. Counters run
+     * from creation of the handler or the last resetStatistics(); the
+     * watch and timeout figures are current.
+     */
+    static Statistics statistics();
+    static void resetStatistics();
+
 private:
+    static DBUSConnectionEventLoop* threadInstance();
+
     bool internalAddConnection(DBusConnection* conn);
     void internalRemoveConnection(DBusConnection* conn);
+    bool internalSetBackend(Backend backend);
+    void updateEpoll(int fd);
+    void scheduleDispatch();
+    void scheduleSync();
+    void wakeHost();
+    void handleTimer(int timerId);
+
+    class Timeout;
+    bool armTimeout(Timeout *t);
+    void disarmTimeout(Timeout *t);
+    bool startTimeoutTimer(Timeout *t, int interval, qint64 now);
 
     /**
-     * Helper class for dbus watcher
+     * Helper class for dbus watcher, attached to its DBusWatch as watch data.
+     * watch and enabled are guarded by pendingMutex; watch is cleared when
+     * libdbus removes the watch, which it may do from any thread.
      */
     class Watcher
     {
     public:
-        Watcher() : watch(0), read(0), write(0) {}
+        Watcher() : watch(0), fd(-1), flags(0), read(0), write(0), enabled(false) {}
 
         DBusWatch* 			watch;
+        int					fd;
+        unsigned int		flags;
         QSocketNotifier*	read;
         QSocketNotifier*	write;
+        bool				enabled;
+    };
+
+    void attachWatcher(Watcher *watcher);
+    void applyWatcher(Watcher *watcher);
+    void detachWatcher(Watcher *watcher);
+
+    class WatchNotifier;
+
+    /**
+     * Helper class for dbus timeout, attached to its DBusTimeout as timeout
+     * data. Times are milliseconds on the loop's monotonic clock. timeout,
+     * enabled and requested are guarded by pendingMutex, the rest belongs
+     * to the owning thread.
+     */
+    class Timeout
+    {
+    public:
+        Timeout() : timeout(0), enabled(false), requested(0), timerId(0), interval(0),
+            period(0), deadline(0), expiry(0) {}
+
+        DBusTimeout*	timeout;	///< cleared when libdbus removes the timeout
+        bool			enabled;	///< enabled by libdbus
+        int				requested;	///< interval last requested by libdbus
+        int				timerId;	///< running Qt timer, 0 if disarmed
+        int				interval;	///< interval the timeout is armed with
+        int				period;		///< interval the Qt timer runs with
+        qint64			deadline;	///< when libdbus expects the timeout
+        qint64			expiry;		///< when the Qt timer fires next
     };
 
-    typedef QMultiHash<int, Watcher> 	Watchers;
-    typedef QHash<int, DBusTimeout*> 	Timeouts;
+    typedef QMultiHash<int, Watcher*> 	Watchers;
+    typedef QHash<int, Timeout*> 		Timeouts;
     typedef QList<DBusConnection*>		Connections;
 
     /**
-     * DBusWatcher objects
+     * DBusWatcher objects by fd
      */
     Watchers 	watchers;
 
     /**
-     * DBusTimeout objects
+     * DBusTimeout objects by Qt timer id
      */
     Timeouts 	timeouts;
+    QElapsedTimer	clock;
 
     /**
      * DBusConnection objects
      */
     Connections	connections;
 
+    /**
+     * Readiness backend in use and, for EpollBackend and ExternalBackend, the
+     * epoll instance, the notifier watching it and the events registered per fd.
+     */
+    Backend				currentBackend;
+    int					epollFd;
+    QSocketNotifier*	epollNotifier;
+
+    /**
+     * For ExternalBackend, the eventfd in the epoll set that wakes the host
+     * and the last made up timer id.
+     */
+    int					wakeFd;
+    int					externalTimerId;
+    QHash<int, quint32>	epollEvents;
+
+    /**
+     * Connections reporting DBUS_DISPATCH_DATA_REMAINS, in report order,
+     * and connections removed by other threads. Guarded by pendingMutex
+     * together with dispatchScheduled and stats.wakeups, as libdbus reports
+     * from whichever thread touches a connection.
+     */
+    QMutex		pendingMutex;
+    Connections	pendingDispatch;
+    Connections	pendingRemoval;
+    bool		dispatchScheduled;
+
+    /**
+     * Watches and timeouts added, toggled or removed by other threads, for
+     * the owning thread to apply to its notifiers, epoll set and timers.
+     * Guarded by pendingMutex.
+     */
+    QList<Watcher*>	addedWatchers;
+    QList<Watcher*>	changedWatchers;
+    QList<Watcher*>	removedWatchers;
+    QList<Timeout*>	changedTimeouts;
+    QList<Timeout*>	removedTimeouts;
+    bool		syncScheduled;
+
+    /**
+     * Messages dispatched per pass, 0 for no limit.
+     */
+    int			budget;
+
+    /**
+     * Coarse timers and no self-wakeups, see setLowWakeupMode().
+     */
+    bool		lowWakeup;
+
+    /**
+     * Counters; the watch and timeout figures are filled in on request,
+     * except for stats.timeouts, which is guarded by pendingMutex.
+     */
+    Statistics	stats;
+
 private Q_SLOTS:
     void readSocket(int fd);
     void writeSocket(int fd);
+    void epollReady();
     void dispatch();
+    void processRemovals();
+    void syncPending();
 
 protected:
     void timerEvent(QTimerEvent *e);
@@ -134,6 +372,7 @@ protected:
     static void removeTimeout(DBusTimeout *timeout, void *data);
     static void toggleTimeout(DBusTimeout *timeout, void *data);
     static void wakeupMain(void *data);
+    static void dispatchStatusChanged(DBusConnection *conn, DBusDispatchStatus status, void *data);
 };
 
 #endif // DBUSCONNECTIONEVENTLOOP_H
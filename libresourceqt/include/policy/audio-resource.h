@@ -129,13 +129,32 @@ public:
     */
     void setStreamTag(const QString &name, const QString &value);
 
+    /**
+    * Starts a group of property changes. Until the matching
+    * commitPropertyChanges() the setters only record the new values, and
+    * the changes are then registered with the Resource Manager in one
+    * message. Transactions nest.
+    */
+    void beginPropertyChanges();
+
+    /**
+    * Ends a group of property changes started with beginPropertyChanges().
+    * The outermost commit emits audioPropertiesChanged() once if any
+    * property was set meanwhile.
+    */
+    void commitPropertyChanges();
+
     virtual ResourceType type() const;
 
 private:
+    void propertiesChanged();
+
     QString group;
     quint32 pid;
     QString streamName;
     QString streamValue;
+    int transactionDepth;
+    bool changedInTransaction;
 
 signals:
     /**
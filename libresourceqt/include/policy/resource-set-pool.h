@@ -0,0 +1,145 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+/**
+* \file resource-set-pool.h
+* \brief Declaration of ResourcePolicy::ResourceSetPool
+*
+* \par License
+* @license LGPL
+* This file is part of libresourceqt
+* \par
+* This library is free software; you can redistribute
+* it and/or modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation
+* version 2.1 of the License.
+*/
+
+#ifndef RESOURCE_SET_POOL_H
+#define RESOURCE_SET_POOL_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <policy/resource-set.h>
+
+namespace ResourcePolicy
+{
+
+/**
+* Keeps \ref ResourceSet objects that are already connected and registered
+* with the manager, so that the first acquire() of a latency critical path
+* (a ringtone, a camera shutter sound) only costs the acquire round-trip:
+* \code
+* ResourcePolicy::ResourceSetPool *pool = new ResourcePolicy::ResourceSetPool(this);
+* QList<ResourcePolicy::ResourceType> ringtone;
+* ringtone << ResourcePolicy::AudioPlaybackType;
+* pool->reserve("ringtone", ringtone);
+* ...
+* ResourcePolicy::ResourceSet *set = pool->take("ringtone", ringtone);
+* set->acquire();
+* \endcode
+* The pool replaces every set taken from it in the background. The modes a
+* set is built with are part of what it is reserved and taken by, as they
+* cannot be changed once the set is registered. Lazy sets are not pooled,
+* being registered ahead is what the pool is for.
+*/
+class ResourceSetPool: public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ResourceSetPool)
+
+public:
+    /**
+    * Modes of the pooled sets, see the \ref ResourceSet setters of the same name.
+    */
+    enum SetOption {
+        DefaultOptions = 0,         ///< a plain ResourceSet
+        AlwaysReply = 0x01,         ///< \ref ResourceSet::setAlwaysReply()
+        AutoRelease = 0x02,         ///< \ref ResourceSet::setAutoRelease()
+        ThreadSafe = 0x04,          ///< \ref ResourceSet::setThreadSafe()
+        PipelinedRequests = 0x08    ///< \ref ResourceSet::setPipelinedRequests()
+    };
+    Q_DECLARE_FLAGS(SetOptions, SetOption)
+
+    /**
+    * Creates an empty pool. \param parent The parent of this class.
+    */
+    explicit ResourceSetPool(QObject *parent = NULL);
+    ~ResourceSetPool();
+
+    /**
+    * Keeps \param count registered sets of the application class
+    * \param applicationClass holding \param resources ready, of which
+    * \param optional are optional, built with \param options. Sets are
+    * created and registered right away, reserving a smaller count than
+    * before lets the pool shrink as sets are taken.
+    */
+    void reserve(const QString &applicationClass, const QList<ResourceType> &resources,
+                 int count = 1, const QList<ResourceType> &optional = QList<ResourceType>(),
+                 SetOptions options = DefaultOptions);
+
+    /**
+    * Hands out a registered set of the application class
+    * \param applicationClass holding \param resources, of which \param optional
+    * are optional, built with \param options, or a new one if none is ready.
+    * The caller owns the returned set.
+    */
+    ResourceSet * take(const QString &applicationClass, const QList<ResourceType> &resources,
+                       const QList<ResourceType> &optional = QList<ResourceType>(),
+                       SetOptions options = DefaultOptions);
+
+    /**
+    * \return the number of sets ready to be taken for the given class, resources and options.
+    */
+    int available(const QString &applicationClass, const QList<ResourceType> &resources,
+                  const QList<ResourceType> &optional = QList<ResourceType>(),
+                  SetOptions options = DefaultOptions) const;
+
+private slots:
+    void refill();
+
+private:
+    struct Composition {
+        Composition() : options(DefaultOptions), count(0) {}
+
+        QString applicationClass;
+        QList<ResourceType> resources;
+        QList<ResourceType> optional;
+        SetOptions options;
+        int count;
+        QList<ResourceSet *> sets;
+    };
+
+    static QString keyOf(const QString &applicationClass, const QList<ResourceType> &resources,
+                         const QList<ResourceType> &optional, SetOptions options);
+    static ResourceSet * buildSet(const Composition &composition, QObject *parent);
+    ResourceSet * createSet(const Composition &composition);
+
+    QHash<QString, Composition> compositions;
+    bool refillScheduled;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(ResourcePolicy::ResourceSetPool::SetOptions)
+
+}
+
+#endif
@@ -212,6 +212,8 @@ public:
 
     /**
     * This method returns a const pointer to a resource of a specific type.
+    * The pointer stays valid until the resource is replaced or deleted, also
+    * when that happens on another thread of a thread-safe set.
     * \param type The type of resource we are interested in.
     * \return a pointer to the Resource if it is defined NULL otherwise.
     */
@@ -255,7 +257,7 @@ public:
          * add the resources before calling initAndConnect(), and then call \ref acquire().
      * \return true if the method succeeds without encountering errors.
      */
-    bool initAndConnect();
+    Q_INVOKABLE bool initAndConnect();
 
     /**
         * Try to acquire the resources in this \ref ResourceSet. The resourcesGranted() (or
@@ -264,12 +266,12 @@ public:
         * you will receive the resourcesGranted() signal when the resources could be acquired for you (this could be a long time),
         * and thus you do not have to re-acquire in this case.
     */
-    bool acquire();
+    Q_INVOKABLE bool acquire();
 
     /**
     * Releases the acquired resources.
     */
-    bool release();
+    Q_INVOKABLE bool release();
 
     /**
     * Commits changes to the \ref ResourcePolicy::ResourceSet. Remember to call update()
@@ -279,8 +281,10 @@ public:
         * \ref setAlwaysReply()).
         * If you do have resources granted then the application will be acknowledged with a \ref resourcesGranted()
         * or \ref lostResources() signal if you lose the resources (in this case you will receive the resources back when possible).
+        * An update() that changes nothing while no resources are granted and no request is outstanding is not
+        * sent; its \ref updateOK() is emitted before update() returns.
     */
-    bool update();
+    Q_INVOKABLE bool update();
 
     /**
     * Sets the auto-release. When loosing the resources due to another
@@ -322,6 +326,154 @@ public:
     */
     bool hasResourcesGranted() { return inAcquireMode; }
 
+    /**
+        * Lets acquire(), update() and release() be sent to the manager without waiting for the
+        * reply to the previous one, so a release() immediately followed by an acquire() costs one
+        * round-trip instead of two. The manager handles the requests in the order they were made,
+        * but the replies need not arrive in that order: an acquire() may be granted only later,
+        * after the replies to requests made after it. Off by default. The mode can only be changed
+        * while no request is outstanding.
+        * \return false if requests are outstanding and the mode was not changed.
+    */
+    bool setPipelinedRequests(bool enabled);
+
+    /**
+        * \return true if requests are pipelined, see \ref setPipelinedRequests().
+    */
+    bool pipelinedRequests() const;
+
+    /**
+        * Makes the set usable from several threads. acquire(), release(), update(), addResource(),
+        * addResourceObject() and deleteResource() may then be called from any thread: calls from
+        * threads other than the one the set lives in are carried out by the set's own thread, in
+        * the order they were made, so the set's resources change only once it gets to them.
+        * Resources given to addResourceObject() are moved to the set's thread. The replies from the manager, and thus all signals of the set,
+        * are delivered on the thread the set lives in, which needs a running event loop. Use
+        * QObject::moveToThread() before the first request to choose that thread.
+        *
+        * This flag should be set once only before calling anything else and cannot be unset.
+        * \return false if the set is already initialized.
+    */
+    bool setThreadSafe();
+
+    /**
+        * \return true if \ref setThreadSafe() has been called.
+    */
+    bool isThreadSafe() const;
+
+    /**
+        * Makes the set keep its configuration to itself until it is first needed. Setting the
+        * audio or video properties then no longer connects to the manager, nothing is sent
+        * until the first \ref acquire() or \ref update(), or an explicit \ref initAndConnect(),
+        * which send the registration, the properties and the request in one go. Useful for
+        * sets built at application launch that may never be used.
+        *
+        * This flag should be set once only before calling anything else and cannot be unset.
+        * \return false if the set is already initialized.
+    */
+    bool setLazy();
+
+    /**
+        * \return true if \ref setLazy() has been called.
+    */
+    bool isLazy() const;
+
+    /**
+        * Limits the \ref resourcesBecameAvailable() signal to the given resources. Advice about
+        * other resources is ignored, and so is advice that repeats the previous one. Advice
+        * arriving in a burst is coalesced, the signal is emitted at most once per iteration of
+        * the event loop. By default the set is interested in all resources.
+        * \param types The resources of interest, an empty list restores the default.
+    */
+    void setAdviceResources(const QList<ResourcePolicy::ResourceType> &types);
+
+    /**
+        * \return the resources set with \ref setAdviceResources(), an empty list if the
+        * set is interested in all resources.
+    */
+    QList<ResourcePolicy::ResourceType> adviceResources() const;
+
+    /**
+        * Sets how long a request may stay unanswered by the manager. After half of it
+        * \ref managerDegraded() is emitted, and once it has passed \ref managerTimedOut()
+        * is emitted and the set registers again, waiting longer before each further attempt
+        * while the manager stays unresponsive. The watchdog is off by default (0); requests made
+        * while it waits to register again are sent once it has.
+    */
+    void setRequestTimeout(int msecs);
+
+    /**
+        * \return the timeout set with \ref setRequestTimeout() in milliseconds.
+    */
+    int requestTimeout() const;
+
+    /**
+        * Makes the set check that the manager is alive when nothing has been heard from it
+        * for the given time, with a ping the manager answers without involving the policy.
+        * An unanswered ping is handled like an unanswered request. Off (0) by default, as
+        * probes wake up an otherwise idle client.
+    */
+    void setProbeInterval(int msecs);
+
+    /**
+        * \return the interval set with \ref setProbeInterval() in milliseconds.
+    */
+    int probeInterval() const;
+
+    /**
+        * Holds back the messages this set sends to the manager until the matching uncork(),
+        * so that for example property registrations, an update() and an acquire() made in
+        * one go are sent in one burst, and a property registration superseded meanwhile is
+        * not sent at all. Messages are never held back beyond the current iteration of the
+        * Qt event loop. Calls nest; see also \ref ResourceSetCork.
+    */
+    void cork();
+
+    /**
+        * Ends a cork() and, for the outermost one, sends the held back messages.
+    */
+    void uncork();
+
+    /**
+        * \return true between cork() and the matching uncork().
+    */
+    bool isCorked() const;
+
+    /**
+        * Selects how the process leaves the manager. By default every deleted set
+        * unregisters itself. With fast exit enabled sets are deleted without telling
+        * the manager, and once the last set is gone the private connection to the
+        * manager is closed, which makes the manager release and forget all sets of
+        * the process at once. Enable it right before shutting down: a set deleted
+        * while others are still alive keeps its resources until then. Each close leaks
+        * the small libresource connection object, which libresource cannot free.
+        * \param enable true to turn fast exit on for the whole process.
+    */
+    static void setFastExit(bool enable = true);
+
+    /**
+        * \return true if \ref setFastExit() has been enabled.
+    */
+    static bool fastExit();
+
+    /**
+        * \internal
+        * Gives the cached manager bitmasks of a set built with setFixedComposition().
+        * \return false, leaving \a all and \a optional untouched, for a dynamic set.
+    */
+    bool fixedBitmasks(quint32 *all, quint32 *optional) const;
+
+protected:
+    /**
+        * Adds the resources of a composition that is known at compile time and
+        * caches the bitmasks sent to the manager, so they are not rebuilt from the
+        * resources on every message. Used by \ref StaticResourceSet.
+        * \param allTypes The resource types of the set, as (1 << ResourceType) bits.
+        * \param optionalTypes The optional subset of \a allTypes.
+        * Adding or deleting a resource afterwards drops the cached masks again.
+    */
+    void setFixedComposition(quint32 allTypes, quint32 optionalTypes);
+
 signals:
     /**
         * This signal is emitted when the Resource Policy Manager notifies that the given
@@ -388,6 +540,19 @@ signals:
     */
     void errorCallback(quint32, const char*);
 
+    /**
+        * Emitted when requests have stayed unanswered for half of the \ref requestTimeout().
+        * \param stuckRequests The types of the requests waiting, for example "acquire".
+    */
+    void managerDegraded(const QStringList &stuckRequests);
+
+    /**
+        * Emitted when requests have stayed unanswered for the whole \ref requestTimeout().
+        * The requests are dropped and the set registers again, re-acquiring what it had.
+        * \param stuckRequests The types of the requests given up on.
+    */
+    void managerTimedOut(const QStringList &stuckRequests);
+
     /**
         * This signals that the manager has started and is available. This signal was called connectedToManager() before,
         * but that name is now changed to managerIsUp() as that better describes that the manager has booted.
@@ -414,16 +579,18 @@ private:
     bool haveAudioProperties;
     bool inAcquireMode;
     QList<requestType> requestQ;
-    QMutex reqMutex;
+    mutable QMutex reqMutex;
     bool ignoreQ;
     ResourceSetPrivate* d;
     bool initialize();
-    void registerAudioProperties();
-    void registerVideoProperties();
+    bool isForeignThread() const;
+    void sendPendingRequests();
     bool proceedIfImFirst(requestType theRequest);
-    void executeNextRequest();
+    void executeNextRequest(requestType answered);
 
 private slots:
+    void registerAudioProperties();
+    void registerVideoProperties();
     void connectedHandler();
     void handleGranted(quint32);
     void handleDeny();
@@ -431,11 +598,38 @@ private slots:
     void handleReleasedByManager();
     void handleResourcesLost(quint32);
     void handleResourcesBecameAvailable(quint32);
+    void deliverAdvice();
     void handleUpdateOK(bool resend);
+    void handleRequestsTimedOut(const QStringList &stuckRequests);
+    void addForwardedResource(void *resource);
+    void deleteForwardedResource(int type);
     void handleAudioPropertiesChanged(const QString &group, quint32 pid, const QString &name, const QString &value);
     void handleVideoPropertiesChanged(quint32 pid);
 
 };
+
+/**
+* Corks a \ref ResourceSet for the lifetime of this object:
+* \code
+* {
+*     ResourcePolicy::ResourceSetCork cork(mySet);
+*     mySet->addResource(VideoPlaybackType);
+*     mySet->update();
+*     mySet->acquire();
+* }
+* \endcode
+*/
+class ResourceSetCork
+{
+    Q_DISABLE_COPY(ResourceSetCork)
+
+public:
+    explicit ResourceSetCork(ResourceSet *set) : set(set) { set->cork(); }
+    ~ResourceSetCork() { set->uncork(); }
+
+private:
+    ResourceSet *set;
+};
 }
 
 #endif
@@ -0,0 +1,192 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+/**
+* \file static-resource-set.h
+* \brief Declaration of ResourcePolicy::StaticResourceSet
+*
+* \par License
+* @license LGPL
+* This file is part of libresourceqt
+* \par
+* This library is free software; you can redistribute
+* it and/or modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation
+* version 2.1 of the License.
+*/
+
+#ifndef STATIC_RESOURCE_SET_H
+#define STATIC_RESOURCE_SET_H
+
+#include <QList>
+#include <QString>
+#include <policy/resource-set.h>
+
+namespace ResourcePolicy
+{
+
+/**
+* Marks \a Type as a mandatory resource of a \ref StaticResourceSet.
+*/
+template <ResourceType Type>
+struct Mandatory
+{
+    static constexpr quint32 allTypes = 1u << Type;
+    static constexpr quint32 optionalTypes = 0;
+};
+
+/**
+* Marks \a Type as an optional resource of a \ref StaticResourceSet.
+*/
+template <ResourceType Type>
+struct Optional
+{
+    static constexpr quint32 allTypes = 1u << Type;
+    static constexpr quint32 optionalTypes = 1u << Type;
+};
+
+/**
+* \internal
+* Folds the \ref Mandatory and \ref Optional markers of a composition into
+* (1 << ResourceType) bitmasks at compile time.
+*/
+template <typename... Resources>
+struct ResourceComposition
+{
+    static constexpr quint32 allTypes = 0;
+    static constexpr quint32 optionalTypes = 0;
+    static constexpr bool hasDuplicates = false;
+};
+
+template <typename First, typename... Rest>
+struct ResourceComposition<First, Rest...>
+{
+    static constexpr quint32 allTypes = First::allTypes | ResourceComposition<Rest...>::allTypes;
+    static constexpr quint32 optionalTypes = First::optionalTypes | ResourceComposition<Rest...>::optionalTypes;
+    static constexpr bool hasDuplicates = (First::allTypes & ResourceComposition<Rest...>::allTypes) != 0
+                                      || ResourceComposition<Rest...>::hasDuplicates;
+};
+
+/**
+* A \ref ResourceSet whose composition is fixed at compile time:
+* \code
+* typedef ResourcePolicy::StaticResourceSet<
+*             ResourcePolicy::Mandatory<ResourcePolicy::AudioPlaybackType>,
+*             ResourcePolicy::Optional<ResourcePolicy::VideoPlaybackType> > PlayerSet;
+* PlayerSet *set = new PlayerSet("player", this);
+* set->acquire();
+* \endcode
+* The set talks to the manager through the same engine as any other
+* ResourceSet, but the bitmasks it registers and acquires with are worked out
+* once when it is built instead of from its resources on every message.
+* Optionality is part of the type: calling Resource::setOptional() on the
+* resources of the set is not supported, the manager keeps seeing the
+* optionality the type gives. addResource() or deleteResource() on the set
+* turns it back into a dynamic set.
+*/
+template <typename... Resources>
+class StaticResourceSet: public ResourceSet
+{
+    typedef ResourceComposition<Resources...> Composition;
+
+public:
+    /** All resource types of the set, as (1 << ResourceType) bits. */
+    static constexpr quint32 allTypes = Composition::allTypes;
+    /** The optional resource types of the set. */
+    static constexpr quint32 optionalTypes = Composition::optionalTypes;
+    /** The mandatory resource types of the set. */
+    static constexpr quint32 mandatoryTypes = allTypes & ~optionalTypes;
+
+    static_assert(sizeof...(Resources) > 0, "a StaticResourceSet needs at least one resource");
+    static_assert(!Composition::hasDuplicates, "a resource type can be in a StaticResourceSet only once");
+    static_assert(allTypes < (1u << NumberOfTypes), "unknown resource type in a StaticResourceSet");
+
+    /**
+        * Creates the set and all of its resources.
+        * \param applicationClass This parameter defines the application class.
+        * \param parent The parent of this class.
+    */
+    explicit StaticResourceSet(const QString &applicationClass, QObject *parent = NULL)
+        : ResourceSet(applicationClass, parent)
+    {
+        setFixedComposition(allTypes, optionalTypes);
+    }
+
+    /**
+        * \return true if \a type is part of the composition.
+    */
+    static constexpr bool hasType(ResourceType type)
+    {
+        return (allTypes >> type) & 1;
+    }
+
+    /**
+        * \return true if \a type is an optional part of the composition.
+    */
+    static constexpr bool hasOptionalType(ResourceType type)
+    {
+        return (optionalTypes >> type) & 1;
+    }
+
+    /**
+        * \return true if \a grantedTypes, (1 << ResourceType) bits as from
+        * grantedTypesOf(), cover every mandatory resource of the set.
+    */
+    static constexpr bool isSatisfiedBy(quint32 grantedTypes)
+    {
+        return (grantedTypes & mandatoryTypes) == mandatoryTypes;
+    }
+
+    /**
+        * Turns the list given by resourcesGranted() into (1 << ResourceType) bits,
+        * restricted to the resources of the set.
+    */
+    static quint32 grantedTypesOf(const QList<ResourceType> &grantedOptionalResources)
+    {
+        quint32 granted = mandatoryTypes;
+        for (int i = 0; i < grantedOptionalResources.size(); i++)
+            granted |= 1u << grantedOptionalResources.at(i);
+        return granted & allTypes;
+    }
+
+    /**
+        * \return the resource types of the set in ResourceType order.
+    */
+    static QList<ResourceType> types()
+    {
+        QList<ResourceType> list;
+        for (int i = 0; i < NumberOfTypes; i++) {
+            if (hasType((ResourceType)i))
+                list << (ResourceType)i;
+        }
+        return list;
+    }
+};
+
+template <typename... Resources>
+constexpr quint32 StaticResourceSet<Resources...>::allTypes;
+template <typename... Resources>
+constexpr quint32 StaticResourceSet<Resources...>::optionalTypes;
+template <typename... Resources>
+constexpr quint32 StaticResourceSet<Resources...>::mandatoryTypes;
+
+}
+
+#endif
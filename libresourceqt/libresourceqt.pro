@@ -33,6 +33,7 @@ HEADERS += $${PUBLIC_HEADERS} src/resource-engine.h
 
 SOURCES += src/resource.cpp \
            src/resource-set.cpp \
+           src/resource-set-pool.cpp \
            src/resource-engine.cpp \
            src/resources.cpp \
            src/audio-resource.cpp
@@ -25,13 +25,15 @@ using namespace ResourcePolicy;
 
 AudioResource::AudioResource(const QString &audioGroup)
     : QObject(), Resource(), group(audioGroup), pid(0),
-      streamName(QString()), streamValue(QString())
+      streamName(QString()), streamValue(QString()),
+      transactionDepth(0), changedInTransaction(false)
 {
 }
 
 AudioResource::AudioResource(const AudioResource &other)
     : QObject(), Resource(other), group(other.group), pid(other.pid),
-      streamName(other.streamName), streamValue(other.streamValue)
+      streamName(other.streamName), streamValue(other.streamValue),
+      transactionDepth(0), changedInTransaction(false)
 {
 }
 
@@ -55,7 +57,7 @@ bool AudioResource::audioGroupIsSet() const
 void AudioResource::setAudioGroup(const QString &newGroup)
 {
     group = newGroup;
-    emit audioPropertiesChanged(group, pid, streamName, streamValue);
+    propertiesChanged();
 }
 
 quint32 AudioResource::processID() const
@@ -66,7 +68,7 @@ quint32 AudioResource::processID() const
 void AudioResource::setProcessID(quint32 newPID)
 {
     pid = newPID;
-    emit audioPropertiesChanged(group, pid, streamName, streamValue);
+    propertiesChanged();
 }
 
 QString AudioResource::streamTagName() const
@@ -92,7 +94,32 @@ void AudioResource::setStreamTag(const QString &name, const QString &value)
 {
     streamName = name;
     streamValue = value;
-    emit audioPropertiesChanged(group, pid, name, value);
+    propertiesChanged();
+}
+
+void AudioResource::beginPropertyChanges()
+{
+    transactionDepth++;
+}
+
+void AudioResource::commitPropertyChanges()
+{
+    if (transactionDepth == 0)
+        return;
+
+    if (--transactionDepth == 0 && changedInTransaction) {
+        changedInTransaction = false;
+        emit audioPropertiesChanged(group, pid, streamName, streamValue);
+    }
+}
+
+void AudioResource::propertiesChanged()
+{
+    if (transactionDepth > 0) {
+        changedInTransaction = true;
+        return;
+    }
+    emit audioPropertiesChanged(group, pid, streamName, streamValue);
 }
 
 ResourceType AudioResource::type() const
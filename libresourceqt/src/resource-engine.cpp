@@ -20,9 +20,15 @@ USA.
 *************************************************************************/
 
 #include "resource-engine.h"
+#include <QElapsedTimer>
+#include <QTimerEvent>
 #include <dbus/dbus.h>
 #include <res-msg.h>
 
+#ifndef RESPROTO_DBUS_MANAGER_NAME
+#define RESPROTO_DBUS_MANAGER_NAME "org.maemo.resource.manager"
+#endif
+
 Q_LOGGING_CATEGORY(lcResourceQt, "resourceQt", QtWarningMsg)
 
 using namespace ResourcePolicy;
@@ -33,6 +39,22 @@ resconn_t *ResourceEngine::libresourceConnection = NULL;
 quint32 ResourceEngine::libresourceUsers = 0;
 
 static QMutex mutex(QMutex::Recursive);
+static DBusConnection *systemBus = NULL;
+static bool fastExit = false;
+
+// Callbacks emit into sets, which may be deleted from the slots. While one
+// runs, abandon() leaves the engine for the event loop to delete.
+static int callbackDepth = 0;
+
+class CallbackScope
+{
+public:
+    CallbackScope() { ++callbackDepth; }
+    ~CallbackScope() { --callbackDepth; }
+};
+
+// The watchdog backs off up to this long between reconnect attempts.
+static const int MaxReconnectDelay = 60000;
 
 static inline quint32 allResourcesToBitmask(const ResourceSet *resourceSet);
 static inline quint32 optionalResourcesToBitmask(const ResourceSet *resourceSet);
@@ -43,11 +65,134 @@ static void handleUnregisterMessage(resmsg_t *, resset_t *, void *data);
 static void handleGrantMessage(resmsg_t *msg, resset_t *rs, void *data);
 static void handleAdviceMessage(resmsg_t *msg, resset_t *rs, void *data);
 static void handleReleaseMessage(resmsg_t *message, resset_t *rs, void *data);
+static void probeReplied(DBusPendingCall *pending, void *data);
+
+static qint64 monotonicTime()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock.msecsSinceReference();
+}
+
+static QString requestTypeName(resmsg_type_t type)
+{
+    switch (type) {
+    case RESMSG_REGISTER:   return "register";
+    case RESMSG_UNREGISTER: return "unregister";
+    case RESMSG_UPDATE:     return "update";
+    case RESMSG_ACQUIRE:    return "acquire";
+    case RESMSG_RELEASE:    return "release";
+    case RESMSG_AUDIO:      return "audio";
+    case RESMSG_VIDEO:      return "video";
+    default:                return QString::number(type);
+    }
+}
+
+RequestMap::RequestMap()
+    : entries()
+{
+    entries.reserve(8);
+}
+
+int RequestMap::indexOf(quint32 requestNo) const
+{
+    for (int i = 0; i < entries.size(); i++) {
+        if (entries.at(i).requestNo == requestNo)
+            return i;
+    }
+    return -1;
+}
+
+void RequestMap::insert(quint32 requestNo, resmsg_type_t type, qint64 sentAt)
+{
+    int i = indexOf(requestNo);
+    if (i >= 0) {
+        entries[i].type = type;
+        entries[i].sentAt = sentAt;
+        entries[i].answered = false;
+        return;
+    }
+    Entry entry;
+    entry.requestNo = requestNo;
+    entry.type = type;
+    entry.sentAt = sentAt;
+    entry.answered = false;
+    entries.append(entry);
+}
+
+/**
+ * A request is answered once its status has arrived. Acquires stay in the
+ * map until they are granted, which may legitimately take long.
+ */
+void RequestMap::setAnswered(quint32 requestNo)
+{
+    int i = indexOf(requestNo);
+    if (i >= 0)
+        entries[i].answered = true;
+}
+
+QList<resmsg_type_t> RequestMap::unansweredSince(qint64 time) const
+{
+    QList<resmsg_type_t> types;
+    for (int i = 0; i < entries.size(); i++) {
+        if (!entries.at(i).answered && entries.at(i).sentAt <= time)
+            types << entries.at(i).type;
+    }
+    return types;
+}
+
+bool RequestMap::hasUnanswered() const
+{
+    for (int i = 0; i < entries.size(); i++) {
+        if (!entries.at(i).answered)
+            return true;
+    }
+    return false;
+}
+
+bool RequestMap::contains(quint32 requestNo) const
+{
+    return indexOf(requestNo) >= 0;
+}
+
+resmsg_type_t RequestMap::value(quint32 requestNo) const
+{
+    int i = indexOf(requestNo);
+    return i >= 0 ? entries.at(i).type : resmsg_type_t();
+}
+
+resmsg_type_t RequestMap::take(quint32 requestNo)
+{
+    resmsg_type_t type = value(requestNo);
+    remove(requestNo);
+    return type;
+}
+
+void RequestMap::remove(quint32 requestNo)
+{
+    int i = indexOf(requestNo);
+    if (i < 0)
+        return;
+    // Order does not matter, move the last entry into the hole.
+    entries[i] = entries.last();
+    entries.removeLast();
+}
+
+int RequestMap::size() const
+{
+    return entries.size();
+}
 
 ResourceEngine::ResourceEngine(ResourceSet *resourceSet)
     : QObject(), connected(false), resourceSet(resourceSet),
-      libresourceSet(NULL), requestId(0), messageMap(), connectionMode(0),
-      identifier(resourceSet->id()), aboutToBeDeleted(false), isConnecting(false)
+      libresourceSet(NULL), requestId(0), messageMap(),
+      applicationClass(resourceSet->applicationClass().toLatin1()), connectionMode(0),
+      identifier(resourceSet->id()), aboutToBeDeleted(false), isConnecting(false),
+      wasConnected(false), registered(false), registeredAll(0), registeredOptional(0),
+      sentAudioRequest(0), corkDepth(0), flushScheduled(false),
+      requestTimeout(resourceSet->requestTimeout()), probeInterval(resourceSet->probeInterval()),
+      watchdogTimer(0), reconnectTimer(0), reconnectDelay(0), degraded(false),
+      lastActivity(monotonicTime()), probeSentAt(0), probeCall(NULL)
 {
     //if (resourceSet->alwaysGetReply()) {
         connectionMode += RESMSG_MODE_ALWAYS_REPLY;
@@ -64,12 +209,16 @@ ResourceEngine::~ResourceEngine()
     QMutexLocker locker(&mutex);
     qCDebug(lcResourceQt, "ResourceEngine::~ResourceEngine(%d) - starting destruction", identifier);
     libresourceUsers--;
+    engineMap.remove(ResourceEngine::libresourceConnection, this);
+    cancelProbe();
 
     if (libresourceSet != NULL) {
         libresourceSet->userdata = NULL;
         qCDebug(lcResourceQt, "ResourceEngine::~ResourceEngine(%d) - unset userdata", identifier);
     }
-    if (libresourceUsers == 0) {
+    if (libresourceUsers == 0 && fastExit) {
+        closeConnection();
+    } else if (libresourceUsers == 0) {
         // Let's just print a log message and still keep
         // ResourceEngine::libresourceConnection around in case we get new
         // users (previously it was set to null, effectively leaking the
@@ -96,7 +245,10 @@ bool ResourceEngine::initialize()
             return false;
         }
         dbus_error_free(&dbusError);
+        // Serviced by this thread, and by the application thread once this
+        // thread exits: all sets of the process share the connection.
         DBUSConnectionEventLoop::addConnection(dbusConnection);
+        systemBus = dbusConnection;
 
         ResourceEngine::libresourceConnection = resproto_init(RESPROTO_ROLE_CLIENT, RESPROTO_TRANSPORT_DBUS,
                                               connectionIsUp, dbusConnection);
@@ -125,6 +277,7 @@ static void handleUnregisterMessage(resmsg_t *message, resset_t *libresourceSet,
 {
     qCDebug(lcResourceQt, "**************** %s() - locking....", __FUNCTION__);
     QMutexLocker locker(&mutex);
+    CallbackScope scope;
     if (NULL == libresourceSet->userdata) {
         qCDebug(lcResourceQt) << QString("IGNORING unregister, no context");
         return;
@@ -145,6 +298,7 @@ void ResourceEngine::disconnected()
 {
     qCDebug(lcResourceQt, "ResourceEngine(%d) - disconnected", identifier);
     connected = false;
+    registered = false;
     emit disconnectedFromManager();
 }
 
@@ -152,6 +306,7 @@ static void handleGrantMessage(resmsg_t *message, resset_t *libresourceSet, void
 {
     qCDebug(lcResourceQt, "**************** %s() - locking....", __FUNCTION__);
     QMutexLocker locker(&mutex);
+    CallbackScope scope;
     if (NULL == libresourceSet->userdata) {
         qCDebug(lcResourceQt, "IGNORING grant, no context: type=0x%04x, id=0x%04x, reqno=0x%04x, resc=0x%04x",
                 message->notify.type, message->notify.id, message->notify.reqno, message->notify.resrc);
@@ -169,8 +324,16 @@ static void handleGrantMessage(resmsg_t *message, resset_t *libresourceSet, void
     engine->receivedGrant(&(message->notify));
 }
 
+// The D-Bus callbacks below never read the resources of the set, which a
+// thread-safe set may be changing on its own thread. The manager can only
+// grant what was registered, so registeredAll stands in for them.
 void ResourceEngine::receivedGrant(resmsg_notify_t *notifyMessage)
 {
+    // After disconnectFromManager() the set may be gone already.
+    if (aboutToBeDeleted)
+        return;
+
+    lastActivity = monotonicTime();
     qCDebug(lcResourceQt, "ResourceEngine(%d) -- receivedGrant: type=0x%04x, id=0x%04x, reqno=0x%04x, resc=0x%04x",
             identifier, notifyMessage->type, notifyMessage->id, notifyMessage->reqno, notifyMessage->resrc);
 
@@ -184,7 +347,7 @@ void ResourceEngine::receivedGrant(resmsg_notify_t *notifyMessage)
         if (unkownRequest) {
             //we don't know this req number => it must be a server override
             qCDebug(lcResourceQt, "ResourceEngine(%d) -- emiting signal resourcesLost()", identifier);
-            emit resourcesLost(allResourcesToBitmask(resourceSet));
+            emit resourcesLost(registeredAll);
 
         } else if (originalMessageType == RESMSG_UPDATE) {
             //An app can loose all resources with update() or if it had no resources,
@@ -192,7 +355,7 @@ void ResourceEngine::receivedGrant(resmsg_notify_t *notifyMessage)
 
             if (resourceSet->hasResourcesGranted()) {
                 qCDebug(lcResourceQt, "ResourceEngine(%d) -- emitting signal resourcesLost() for update", identifier);
-                emit resourcesLost(allResourcesToBitmask(resourceSet));
+                emit resourcesLost(registeredAll);
             } else {
                 if ( resourceSet->alwaysGetReply() ) {
                     //If alwaysReply is on and we didn't have resources at update() then we come from here to updateOK()
@@ -218,6 +381,7 @@ void ResourceEngine::receivedGrant(resmsg_notify_t *notifyMessage)
     }
 
     messageMap.remove(notifyMessage->reqno);
+    wasInAcquireMode.remove(notifyMessage->reqno);
 }
 
 
@@ -225,6 +389,7 @@ static void handleReleaseMessage(resmsg_t *message, resset_t *rs, void *)
 {
     qCDebug(lcResourceQt, "**************** %s() - locking....", __FUNCTION__);
     QMutexLocker locker(&mutex);
+    CallbackScope scope;
     if (NULL == rs->userdata) {
         qCDebug(lcResourceQt) << QString("IGNORING release, no context");
         return;
@@ -245,8 +410,7 @@ static void handleReleaseMessage(resmsg_t *message, resset_t *rs, void *)
 
 void ResourceEngine::receivedRelease(resmsg_notify_t *message)
 {
-    uint32_t allResources = allResourcesToBitmask(resourceSet);
-    qCDebug(lcResourceQt, "ResourceEngine(%d) - %s: have: %02x got %02x", identifier, __FUNCTION__, allResources, message->resrc);
+    qCDebug(lcResourceQt, "ResourceEngine(%d) - %s: have: %02x got %02x", identifier, __FUNCTION__, registeredAll, message->resrc);
     emit resourcesReleasedByManager();
 }
 
@@ -254,6 +418,7 @@ static void handleAdviceMessage(resmsg_t *message, resset_t *libresourceSet, voi
 {
     qCDebug(lcResourceQt, "**************** %s() - locking....", __FUNCTION__);
     QMutexLocker locker(&mutex);
+    CallbackScope scope;
     if (NULL == libresourceSet->userdata) {
         qCDebug(lcResourceQt) << QString("IGNORING advice, no context");
         return;
@@ -274,8 +439,7 @@ static void handleAdviceMessage(resmsg_t *message, resset_t *libresourceSet, voi
 
 void ResourceEngine::receivedAdvice(resmsg_notify_t *message)
 {
-    uint32_t allResources = allResourcesToBitmask(resourceSet);
-    qCDebug(lcResourceQt, "ResourceEngine(%d) - %s: have: %02x got %02x", identifier, __FUNCTION__, allResources, message->resrc);
+    qCDebug(lcResourceQt, "ResourceEngine(%d) - %s: have: %02x got %02x", identifier, __FUNCTION__, registeredAll, message->resrc);
     emit resourcesBecameAvailable(message->resrc);
 }
 
@@ -287,14 +451,19 @@ bool ResourceEngine::connectToManager()
         qCDebug(lcResourceQt, "ResourceEngine::%s().... allready connecting, ignoring request", __FUNCTION__);
         return true;
     }
+    if (reconnectTimer != 0) {
+        // Backing off after a timeout; the set is replayed when the timer fires.
+        qCDebug(lcResourceQt, "ResourceEngine(%d) - reconnecting in %d ms, ignoring request", identifier, reconnectDelay);
+        return true;
+    }
     isConnecting = true;
     resmsg_t resourceMessage;
     memset(&resourceMessage, 0, sizeof(resmsg_t));
     resourceMessage.record.type = RESMSG_REGISTER;
-    resourceMessage.record.id = resourceSet->id();
+    resourceMessage.record.id = identifier;
     resourceMessage.record.reqno = ++requestId;
 
-    messageMap.insert(requestId, RESMSG_REGISTER);
+    trackRequest(requestId, RESMSG_REGISTER);
 
     uint32_t allResources, optionalResources;
     allResources = allResourcesToBitmask(resourceSet);
@@ -305,9 +474,8 @@ bool ResourceEngine::connectToManager()
     resourceMessage.record.rset.share = 0;
     resourceMessage.record.rset.mask = 0;
 
-    QByteArray ba = resourceSet->applicationClass().toLatin1();
     resourceMessage.record.app_id = resmsg_generate_app_id(QCoreApplication::applicationPid());
-    resourceMessage.record.klass = ba.data();
+    resourceMessage.record.klass = const_cast<char *>(applicationClass.constData());
 
     resourceMessage.record.mode = connectionMode;
 
@@ -318,6 +486,13 @@ bool ResourceEngine::connectToManager()
                                      statusCallbackHandler);
     if (libresourceSet == NULL)
         return false;
+    registered = true;
+    registeredAll = allResources;
+    registeredOptional = optionalResources;
+    // A new registration starts without audio properties.
+    acknowledgedAudio.clear();
+    sentAudio.clear();
+    sentAudioRequest = 0;
     libresourceSet->userdata = this; //save our context
     //locker.unlock();
     qCDebug(lcResourceQt, "ResourceEngine(%d)::%s() - **************** unlocked! returning true", identifier, __FUNCTION__);
@@ -333,11 +508,28 @@ bool ResourceEngine::disconnectFromManager()
 
     qCDebug(lcResourceQt, "ResourceEngine(%d)::%s() - disconnecting from manager - %p",
             identifier, __FUNCTION__, ResourceEngine::libresourceConnection);
+
+    // Requests made before the disconnect go out before the unregister.
+    corkDepth = 0;
+    flushCorkedMessages();
+
     connected = false;
     aboutToBeDeleted = true;
 
+    // The set is being deleted and the engine outlives it until the
+    // unregister is answered: nothing may reach back into the set.
+    if (watchdogTimer != 0) {
+        killTimer(watchdogTimer);
+        watchdogTimer = 0;
+    }
+    if (reconnectTimer != 0) {
+        killTimer(reconnectTimer);
+        reconnectTimer = 0;
+    }
+    resourceSet = NULL;
+
     resourceMessage.record.type = RESMSG_UNREGISTER;
-    resourceMessage.record.id = resourceSet->id();
+    resourceMessage.record.id = identifier;
     resourceMessage.record.reqno = ++requestId;
 
 //    messageMap.insert(requestId, RESMSG_UNREGISTER);
@@ -349,18 +541,90 @@ bool ResourceEngine::disconnectFromManager()
     return ret;
 }
 
+/**
+ * The fast-exit counterpart of disconnectFromManager(): the set is deleted
+ * without unregistering. The engine stops answering the manager and is
+ * deleted right away, or by the event loop if a callback is running.
+ */
+void ResourceEngine::abandon()
+{
+    QMutexLocker locker(&mutex);
+    connected = false;
+    aboutToBeDeleted = true;
+    if (watchdogTimer != 0) {
+        killTimer(watchdogTimer);
+        watchdogTimer = 0;
+    }
+    if (reconnectTimer != 0) {
+        killTimer(reconnectTimer);
+        reconnectTimer = 0;
+    }
+    resourceSet = NULL;
+    if (libresourceSet != NULL)
+        libresourceSet->userdata = NULL;
+
+    if (callbackDepth > 0)
+        deleteLater();
+    else
+        delete this;
+}
+
 bool ResourceEngine::toBeDeleted()
 {
     return aboutToBeDeleted;
 }
 
+/**
+ * In fast-exit mode sets are deleted without an UNREGISTER each. When the
+ * last engine is gone the private connection is closed, and the manager
+ * drops everything the process had registered in one go.
+ */
+void ResourceEngine::setFastExit(bool enable)
+{
+    QMutexLocker locker(&mutex);
+    fastExit = enable;
+    if (fastExit && libresourceUsers == 0)
+        closeConnection();
+}
+
+bool ResourceEngine::isFastExit()
+{
+    QMutexLocker locker(&mutex);
+    return fastExit;
+}
+
+void ResourceEngine::closeConnection()
+{
+    if (systemBus == NULL)
+        return;
+
+    qCDebug(lcResourceQt, "ResourceEngine::%s() - closing the manager connection %p",
+            __FUNCTION__, systemBus);
+    DBUSConnectionEventLoop::removeConnection(systemBus);
+    dbus_connection_close(systemBus);
+    dbus_connection_unref(systemBus);
+    systemBus = NULL;
+    // libresource has no call to free its connection: it is leaked, and
+    // so are the filters it installed on the closed D-Bus connection. They
+    // never run again, as nothing dispatches the connection any more. A
+    // later set starts over with a new one.
+    libresourceConnection = NULL;
+}
+
 static inline quint32 allResourcesToBitmask(const ResourceSet *resourceSet)
 {
-    QList<Resource *> resourceList = resourceSet->resources();
+    quint32 fixed;
+    if (resourceSet->fixedBitmasks(&fixed, NULL))
+        return fixed;
+
+    // Walk the set directly, resources() would allocate a list per message.
     quint32 bitmask = 0;
-    for (int i = 0; i < resourceList.size(); i++) {
-        quint32 bits = resourceTypeToLibresourceType(resourceList[i]->type());
-        qCDebug(lcResourceQt, "Converted Resource 0x%02x to 0x%02x", resourceList[i]->type(), bits);
+    for (int i = 0; i < NumberOfTypes; i++) {
+        const Resource *resource = resourceSet->resource((ResourceType)i);
+        if (resource == NULL)
+            continue;
+        quint32 bits = resourceTypeToLibresourceType(resource->type());
+        qCDebug(lcResourceQt, "Converted Resource 0x%02x to 0x%02x", resource->type(), bits);
         bitmask += bits;
     }
     qCDebug(lcResourceQt, "All resources as bitmask is 0x%04x", bitmask);
@@ -406,11 +670,15 @@ quint32 ResourcePolicy::resourceTypeToLibresourceType(ResourceType type)
 
 static inline quint32 optionalResourcesToBitmask(const ResourceSet *resourceSet)
 {
-    QList<Resource *> resourceList = resourceSet->resources();
+    quint32 fixed;
+    if (resourceSet->fixedBitmasks(NULL, &fixed))
+        return fixed;
+
     quint32 bitmask = 0;
-    for (int i = 0; i < resourceList.size(); i++) {
-        if (resourceList[i]->isOptional()) {
-            bitmask += resourceTypeToLibresourceType(resourceList[i]->type());
+    for (int i = 0; i < NumberOfTypes; i++) {
+        const Resource *resource = resourceSet->resource((ResourceType)i);
+        if (resource != NULL && resource->isOptional()) {
+            bitmask += resourceTypeToLibresourceType(resource->type());
         }
     }
     return bitmask;
@@ -420,6 +688,7 @@ static void statusCallbackHandler(resset_t *libresourceSet, resmsg_t *message)
 {
     qCDebug(lcResourceQt, "**************** %s().... %d", __FUNCTION__, __LINE__);
     QMutexLocker locker(&mutex);
+    CallbackScope scope;
     if (NULL == libresourceSet->userdata) {
         qCDebug(lcResourceQt, "IGNORING status message, no context: type=0x%04x, id=0x%04x, reqno=0x%04x, errcod=%d",
                 message->status.type, message->status.id, message->status.reqno, message->status.errcod);
@@ -455,12 +724,16 @@ static void statusCallbackHandler(resset_t *libresourceSet, resmsg_t *message)
 
 void ResourceEngine::handleStatusMessage(quint32 requestNo)
 {
+    messageMap.setAnswered(requestNo);
+    lastActivity = monotonicTime();
     resmsg_type_t originalMessageType = messageMap.value(requestNo);
     qCDebug(lcResourceQt, "Received a status message: %u(0x%02x)", requestNo, originalMessageType);
     if (originalMessageType == RESMSG_REGISTER) {
         qCDebug(lcResourceQt, "ResourceEngine(%d) - connected!", identifier);
         connected = true;
         isConnecting = false;
+        wasConnected = true;
+        reconnectDelay = 0;
         emit connectedToManager();
         messageMap.remove(requestNo);
     } else if (originalMessageType == RESMSG_UNREGISTER) {
@@ -486,6 +759,12 @@ void ResourceEngine::handleStatusMessage(quint32 requestNo)
             emit updateOK(false);
         //}
 
+    } else if (originalMessageType == RESMSG_AUDIO) {
+        if (requestNo == sentAudioRequest) {
+            acknowledgedAudio = sentAudio;
+            sentAudioRequest = 0;
+        }
+        messageMap.remove(requestNo);
     } else if (originalMessageType == RESMSG_ACQUIRE) {
         qCDebug(lcResourceQt, "ResourceEngine(%d) - Acquire status", identifier);
     } else if (originalMessageType == RESMSG_RELEASE) {
@@ -501,6 +780,16 @@ void ResourceEngine::handleError(quint32 requestNo, qint32 code, const char *mes
     qCDebug(lcResourceQt, "ResourceEngine(%d) - Error on request %u(0x%02x): %d - %s",
             identifier, requestNo, originalMessageType, code, message);
     messageMap.remove(requestNo);
+    wasInAcquireMode.remove(requestNo);
+
+    // What the manager has is unknown now, do not elide the next update.
+    if (originalMessageType == RESMSG_REGISTER || originalMessageType == RESMSG_UPDATE)
+        registered = false;
+    if (originalMessageType == RESMSG_AUDIO) {
+        acknowledgedAudio.clear();
+        sentAudio.clear();
+        sentAudioRequest = 0;
+    }
 
     qCDebug(lcResourceQt) << QString("emitting errorCallback");
     emit errorCallback(code, message);
@@ -516,6 +805,16 @@ bool ResourceEngine::isConnectingToManager()
     return isConnecting;
 }
 
+/**
+ * Requests may follow a REGISTER before its status arrives: the manager
+ * handles the messages of a set in the order they were sent, so they do
+ * not need to wait for a round-trip.
+ */
+bool ResourceEngine::canSendRequests()
+{
+    return connected || (isConnecting && libresourceSet != NULL);
+}
+
 bool ResourceEngine::acquireResources()
 {
     qCDebug(lcResourceQt, "ResourceEngine(%d)::%s() - **************** locking....", identifier, __FUNCTION__);
@@ -527,10 +826,10 @@ bool ResourceEngine::acquireResources()
     message.possess.id    = resourceSet->id();
     message.possess.reqno = ++requestId;
 
-    messageMap.insert(requestId, RESMSG_ACQUIRE);
+    trackRequest(requestId, RESMSG_ACQUIRE);
 
     qCDebug(lcResourceQt, "ResourceEngine(%d) - acquire %u:%u", identifier, resourceSet->id(), requestId);
-    int success = resproto_send_message(libresourceSet, &message, statusCallbackHandler);
+    int success = sendMessage(&message);
 
     return success;
 }
@@ -546,43 +845,60 @@ bool ResourceEngine::releaseResources()
     message.possess.id    = resourceSet->id();
     message.possess.reqno = ++requestId;
 
-    messageMap.insert(requestId, RESMSG_RELEASE);
+    trackRequest(requestId, RESMSG_RELEASE);
     qCDebug(lcResourceQt, "ResourceEngine(%d) - release %u:%u", identifier, resourceSet->id(), requestId);
-    int success = resproto_send_message(libresourceSet, &message, statusCallbackHandler);
+    int success = sendMessage(&message);
 
     return success;
 }
 
+/**
+ * True if the manager already has the resources the set holds now. The
+ * application class cannot change during the life of an engine, so only
+ * the masks need to be compared.
+ */
+bool ResourceEngine::registrationIsCurrent()
+{
+    QMutexLocker locker(&mutex);
+    return registered
+        && registeredAll == allResourcesToBitmask(resourceSet)
+        && registeredOptional == optionalResourcesToBitmask(resourceSet);
+}
+
 bool ResourceEngine::updateResources()
 {
     qCDebug(lcResourceQt, "ResourceEngine(%d)::%s() - **************** locking....", identifier, __FUNCTION__);
     QMutexLocker locker(&mutex);
+
+    uint32_t allResources, optionalResources;
+    allResources = allResourcesToBitmask(resourceSet);
+    optionalResources = optionalResourcesToBitmask(resourceSet);
+
     resmsg_t message;
     memset(&message, 0, sizeof(resmsg_t));
     message.record.type = RESMSG_UPDATE;
     message.record.id = resourceSet->id();
     message.record.reqno = ++requestId;
 
-    uint32_t allResources, optionalResources;
-    allResources = allResourcesToBitmask(resourceSet);
-    optionalResources = optionalResourcesToBitmask(resourceSet);
-
     message.record.rset.all = allResources;
     message.record.rset.opt = optionalResources;
     message.record.rset.share = 0;
     message.record.rset.mask = 0;
 
-    QByteArray ba = resourceSet->applicationClass().toLatin1();
-    message.record.klass = ba.data();
+    message.record.klass = const_cast<char *>(applicationClass.constData());
 
-    messageMap.insert(requestId, RESMSG_UPDATE);
+    trackRequest(requestId, RESMSG_UPDATE);
 
-    bool hasGranted = resourceSet->resources().size() ? true : false;
+    bool hasGranted = allResources ? true : false;
 
     wasInAcquireMode.insert(requestId, hasGranted /*hasResourcesGranted()*/ );
 
+    registered = true;
+    registeredAll = allResources;
+    registeredOptional = optionalResources;
+
     qCDebug(lcResourceQt, "ResourceEngine(%d) - update %u:%u", identifier, resourceSet->id(), requestId);
-    int success = resproto_send_message(libresourceSet, &message, statusCallbackHandler);
+    int success = sendMessage(&message);
 
     return success;
 }
@@ -615,16 +931,26 @@ bool ResourceEngine::registerAudioProperties(const QString &audioGroup, quint32
                 identifier, message.audio.property.name, message.audio.property.match.pattern);
     }
 
+    // Nothing to send if the manager has, or is about to get, exactly these.
+    QByteArray signature = groupBa + '\n' + QByteArray::number(pid) + '\n' + nameBa + '\n' + valueBa;
+    if (signature == (sentAudioRequest != 0 ? sentAudio : acknowledgedAudio)) {
+        qCDebug(lcResourceQt, "ResourceEngine(%d) - audio properties unchanged, not sent", identifier);
+        return true;
+    }
+
     message.audio.type = RESMSG_AUDIO;
     message.audio.id    = resourceSet->id();
     message.audio.reqno = ++requestId;
 
+    sentAudio = signature;
+    sentAudioRequest = requestId;
+
     message.audio.type  = RESMSG_AUDIO;
 
-    messageMap.insert(requestId, RESMSG_AUDIO);
+    trackRequest(requestId, RESMSG_AUDIO);
 
     qCDebug(lcResourceQt, "ResourceEngine(%d) - audio %u:%u", identifier, resourceSet->id(), requestId);
-    int success = resproto_send_message(libresourceSet, &message, statusCallbackHandler);
+    int success = sendMessage(&message);
     qCDebug(lcResourceQt, "ResourceEngine(%d) - resproto_send_message returned %d", identifier, success);
 
     return success;
@@ -648,27 +974,147 @@ bool ResourceEngine::registerVideoProperties(quint32 pid)
     message.video.reqno = ++requestId;
     message.video.type  = RESMSG_VIDEO;
 
-    messageMap.insert(requestId, RESMSG_VIDEO);
+    trackRequest(requestId, RESMSG_VIDEO);
 
     qCDebug(lcResourceQt, "ResourceEngine(%d) - video %u:%u", identifier, resourceSet->id(), requestId);
-    int success = resproto_send_message(libresourceSet, &message, statusCallbackHandler);
+    int success = sendMessage(&message);
     qCDebug(lcResourceQt, "ResourceEngine(%d) - resproto_send_message returned %d", identifier, success);
 
     return success;
 }
 
+/**
+ * Hold back the messages of this engine until the matching uncork(), or
+ * at the latest until the event loop runs again, and send them in one
+ * burst. Corking nests.
+ */
+void ResourceEngine::cork()
+{
+    QMutexLocker locker(&mutex);
+    corkDepth++;
+}
+
+void ResourceEngine::uncork()
+{
+    QMutexLocker locker(&mutex);
+    if (corkDepth == 0)
+        return;
+
+    if (--corkDepth == 0)
+        flushCorkedMessages();
+}
+
+bool ResourceEngine::isCorked()
+{
+    return corkDepth > 0;
+}
+
+bool ResourceEngine::sendMessage(resmsg_t *message)
+{
+    if (libresourceSet == NULL) {
+        // Not registered, or the registration was dropped after a timeout.
+        qCDebug(lcResourceQt, "ResourceEngine(%d) - not registered, refusing message %u",
+                identifier, message->any.reqno);
+        messageMap.remove(message->any.reqno);
+        if (message->any.reqno == sentAudioRequest)
+            sentAudioRequest = 0;
+        return false;
+    }
+
+    if (corkDepth == 0)
+        return resproto_send_message(libresourceSet, message, statusCallbackHandler);
+
+    int i = corkedMessages.size();
+
+    // Property registrations only carry the latest state, a newer one
+    // replaces a held back one.
+    if (message->type == RESMSG_AUDIO || message->type == RESMSG_VIDEO) {
+        for (i = 0; i < corkedMessages.size(); i++) {
+            if (corkedMessages.at(i).message.type == message->type) {
+                messageMap.remove(corkedMessages.at(i).message.any.reqno);
+                qCDebug(lcResourceQt, "ResourceEngine(%d) - replacing corked message %u with %u",
+                        identifier, corkedMessages.at(i).message.any.reqno, message->any.reqno);
+                break;
+            }
+        }
+    }
+
+    if (i == corkedMessages.size())
+        corkedMessages.resize(i + 1);
+
+    CorkedMessage &corked = corkedMessages[i];
+    corked.message = *message;
+
+    if (message->type == RESMSG_AUDIO) {
+        corked.appId = message->audio.app_id;
+        corked.group = message->audio.group;
+        corked.name = message->audio.property.name;
+        corked.pattern = message->audio.property.match.pattern;
+    }
+
+    qCDebug(lcResourceQt, "ResourceEngine(%d) - corked message %u, %d held back",
+            identifier, message->any.reqno, corkedMessages.size());
+
+    // Never hold messages back past the current event loop iteration.
+    if (!flushScheduled) {
+        flushScheduled = true;
+        QMetaObject::invokeMethod(this, "flushCorkedMessages", Qt::QueuedConnection);
+    }
+
+    return true;
+}
+
+void ResourceEngine::flushCorkedMessages()
+{
+    QMutexLocker locker(&mutex);
+    flushScheduled = false;
+
+    if (corkedMessages.isEmpty() || libresourceSet == NULL)
+        return;
+
+    qCDebug(lcResourceQt, "ResourceEngine(%d) - flushing %d corked messages",
+            identifier, corkedMessages.size());
+
+    QVector<CorkedMessage> messages;
+    messages.swap(corkedMessages);
+
+    for (int i = 0; i < messages.size(); i++) {
+        CorkedMessage &corked = messages[i];
+
+        if (corked.message.type == RESMSG_AUDIO) {
+            corked.message.audio.app_id = corked.appId.isNull() ? NULL : corked.appId.data();
+            corked.message.audio.group = corked.group.isNull() ? NULL : corked.group.data();
+            corked.message.audio.property.name = corked.name.isNull() ? NULL : corked.name.data();
+            corked.message.audio.property.match.pattern =
+                corked.pattern.isNull() ? NULL : corked.pattern.data();
+        }
+
+        resproto_send_message(libresourceSet, &corked.message, statusCallbackHandler);
+    }
+}
+
 static void connectionIsUp(resconn_t *connection)
 {
     qCDebug(lcResourceQt, "**************** %s() - locking....", __FUNCTION__);
     QMutexLocker locker(&mutex);
+    CallbackScope scope;
 
     qCDebug(lcResourceQt) << QString("connection is up");
 
+    // Every set of the process registers again in one burst: the
+    // REGISTERs go out first and the replayed properties and acquires are
+    // held back until all of them have been sent.
     QList<ResourceEngine*> engines = engineMap.values(connection);
+    for (int i = 0; i < engines.size(); ++i) {
+        engines.at(i)->cork();
+    }
     for (int i = 0; i < engines.size(); ++i) {
         ResourceEngine *resourceEngine = engines.at(i);
         resourceEngine->handleConnectionIsUp(connection);
     }
+    for (int i = 0; i < engines.size(); ++i) {
+        engines.at(i)->uncork();
+    }
 }
 
 void ResourceEngine::handleConnectionIsUp(resconn_t *connection)
@@ -676,6 +1122,16 @@ void ResourceEngine::handleConnectionIsUp(resconn_t *connection)
 
     if (ResourceEngine::libresourceConnection == connection) {
         qCDebug(lcResourceQt, "ResourceEngine(%d) - connected to manager, connection=%p", identifier, connection);
+        if (wasConnected) {
+            // The manager restarted: it knows nothing of this set, and the
+            // requests sent to its previous instance will not be answered.
+            qCDebug(lcResourceQt, "ResourceEngine(%d) - manager restarted, registering again", identifier);
+            connected = false;
+            isConnecting = false;
+            registered = false;
+            messageMap = RequestMap();
+            wasInAcquireMode.clear();
+        }
         emit connectedToManager();
     } else {
         qCDebug(lcResourceQt, "ResourceEngine(%d) - ignoring Connection is up, it is not for us (%p != %p)",
@@ -683,6 +1139,220 @@ void ResourceEngine::handleConnectionIsUp(resconn_t *connection)
     }
 }
 
+void ResourceEngine::trackRequest(quint32 requestNo, resmsg_type_t type)
+{
+    messageMap.insert(requestNo, type, monotonicTime());
+    if (watchdogTimer == 0 && requestTimeout > 0)
+        QMetaObject::invokeMethod(this, "armWatchdog", Qt::AutoConnection);
+}
+
+/**
+ * The watchdog runs while requests are unanswered, and for as long as the
+ * engine lives if idle probes are enabled. Otherwise the engine causes no
+ * wakeups at all.
+ */
+void ResourceEngine::armWatchdog()
+{
+    QMutexLocker locker(&mutex);
+    if (watchdogTimer != 0 || requestTimeout <= 0 || aboutToBeDeleted)
+        return;
+
+    int period = requestTimeout / 4;
+    if (probeInterval > 0 && probeInterval < period)
+        period = probeInterval;
+    watchdogTimer = startTimer(qMax(period, 100), Qt::CoarseTimer);
+}
+
+/**
+ * The set's requestTimeout() and probeInterval(), copied so that the timers
+ * never need the set. Called on the engine's thread.
+ */
+void ResourceEngine::setWatchdog(int timeout, int interval)
+{
+    QMutexLocker locker(&mutex);
+    requestTimeout = timeout;
+    probeInterval = interval;
+    if (watchdogTimer != 0) {
+        killTimer(watchdogTimer);
+        watchdogTimer = 0;
+    }
+    // Re-armed with the new period; it stops itself again when idle.
+    armWatchdog();
+}
+
+void ResourceEngine::timerEvent(QTimerEvent *event)
+{
+    QMutexLocker locker(&mutex);
+    CallbackScope scope;
+    if (event->timerId() == reconnectTimer) {
+        killTimer(reconnectTimer);
+        reconnectTimer = 0;
+        reconnect();
+    } else if (event->timerId() == watchdogTimer) {
+        checkHealth();
+    }
+}
+
+void ResourceEngine::checkHealth()
+{
+    int timeout = requestTimeout;
+    qint64 now = monotonicTime();
+
+    QStringList stuck;
+    foreach (resmsg_type_t type, messageMap.unansweredSince(now - timeout))
+        stuck << requestTypeName(type);
+    if (probeSentAt != 0 && probeSentAt <= now - timeout)
+        stuck << "probe";
+
+    if (!stuck.isEmpty()) {
+        handleTimeout(stuck);
+        return;
+    }
+
+    QStringList slow;
+    foreach (resmsg_type_t type, messageMap.unansweredSince(now - timeout / 2))
+        slow << requestTypeName(type);
+    if (probeSentAt != 0 && probeSentAt <= now - timeout / 2)
+        slow << "probe";
+
+    if (!slow.isEmpty()) {
+        if (!degraded) {
+            degraded = true;
+            qCDebug(lcResourceQt, "ResourceEngine(%d) - manager is slow: %s",
+                    identifier, qPrintable(slow.join(",")));
+            emit connectionDegraded(slow);
+        }
+        return;
+    }
+    degraded = false;
+
+    if (messageMap.hasUnanswered() || probeSentAt != 0) {
+        return;
+    } else if (probeInterval > 0 && connected) {
+        if (now - lastActivity >= probeInterval)
+            sendProbe();
+    } else {
+        killTimer(watchdogTimer);
+        watchdogTimer = 0;
+    }
+}
+
+/**
+ * A D-Bus ping to the manager: it is answered by the manager's main loop
+ * without touching the policy, so it shows that the manager is alive.
+ */
+void ResourceEngine::sendProbe()
+{
+    if (systemBus == NULL)
+        return;
+
+    DBusMessage *message = dbus_message_new_method_call(RESPROTO_DBUS_MANAGER_NAME, "/",
+                                                        "org.freedesktop.DBus.Peer", "Ping");
+    if (message == NULL)
+        return;
+
+    DBusPendingCall *pending = NULL;
+    if (dbus_connection_send_with_reply(systemBus, message, &pending, requestTimeout)
+        && pending != NULL) {
+        probeSentAt = monotonicTime();
+        lastActivity = probeSentAt;
+        probeCall = pending;
+        // Only the id is passed, the engine may be gone when the reply comes.
+        dbus_pending_call_set_notify(pending, probeReplied,
+                                     reinterpret_cast<void *>(quintptr(identifier)), NULL);
+    }
+    dbus_message_unref(message);
+}
+
+void ResourceEngine::cancelProbe()
+{
+    if (probeCall == NULL)
+        return;
+    dbus_pending_call_cancel(probeCall);
+    dbus_pending_call_unref(probeCall);
+    probeCall = NULL;
+    probeSentAt = 0;
+}
+
+static void probeReplied(DBusPendingCall *pending, void *data)
+{
+    QMutexLocker locker(&mutex);
+    quint32 identifier = quint32(reinterpret_cast<quintptr>(data));
+
+    QList<ResourceEngine*> engines = engineMap.values();
+    for (int i = 0; i < engines.size(); ++i) {
+        if (engines.at(i)->id() == identifier)
+            engines.at(i)->handleProbeReply(pending);
+    }
+}
+
+void ResourceEngine::handleProbeReply(DBusPendingCall *pending)
+{
+    // A late reply to a probe given up on says nothing about the current one.
+    if (pending != probeCall)
+        return;
+
+    // The error libdbus makes up when the probe times out is no answer,
+    // the watchdog sees the probe as stuck.
+    DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+    bool answered = reply != NULL && dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_ERROR;
+    if (reply != NULL)
+        dbus_message_unref(reply);
+    if (!answered)
+        return;
+
+    dbus_pending_call_unref(probeCall);
+    probeCall = NULL;
+    probeSentAt = 0;
+    lastActivity = monotonicTime();
+}
+
+/**
+ * Give up on the requests the manager did not answer in time and register
+ * again, backing off exponentially while the manager stays unresponsive.
+ */
+void ResourceEngine::handleTimeout(const QStringList &stuckRequests)
+{
+    qCDebug(lcResourceQt, "ResourceEngine(%d) - requests timed out: %s",
+            identifier, qPrintable(stuckRequests.join(",")));
+
+    killTimer(watchdogTimer);
+    watchdogTimer = 0;
+    degraded = false;
+    cancelProbe();
+
+    if (libresourceSet != NULL) {
+        // Anything still arriving for the old registration is ignored.
+        resmsg_t message;
+        memset(&message, 0, sizeof(resmsg_t));
+        message.record.type = RESMSG_UNREGISTER;
+        message.record.id = identifier;
+        message.record.reqno = ++requestId;
+        libresourceSet->userdata = NULL;
+        resconn_disconnect(libresourceSet, &message, statusCallbackHandler);
+        libresourceSet = NULL;
+    }
+    connected = false;
+    isConnecting = false;
+    registered = false;
+    messageMap = RequestMap();
+    wasInAcquireMode.clear();
+    // Held back messages carry request numbers of the dropped registration.
+    corkedMessages.clear();
+
+    reconnectDelay = reconnectDelay == 0 ? 1000 : qMin(reconnectDelay * 2, MaxReconnectDelay);
+    reconnectTimer = startTimer(reconnectDelay, Qt::CoarseTimer);
+
+    emit requestsTimedOut(stuckRequests);
+}
+
+void ResourceEngine::reconnect()
+{
+    qCDebug(lcResourceQt, "ResourceEngine(%d) - reconnecting after %d ms", identifier, reconnectDelay);
+    // The set replays its state as after a manager restart.
+    emit connectedToManager();
+}
+
 quint32 ResourceEngine::id()
 {
     return identifier;
@@ -24,7 +24,10 @@ USA.
 
 #include <QObject>
 #include <QMap>
+#include <QVector>
+#include <QByteArray>
 #include <QString>
+#include <QStringList>
 #include <QLoggingCategory>
 
 #include <dbus/dbus.h>
@@ -41,6 +44,39 @@ namespace ResourcePolicy {
 
 quint32 resourceTypeToLibresourceType(ResourceType type);
 
+/**
+ * Outstanding requests keyed by request number. Only a handful of
+ * requests are ever in flight, so a flat array that reuses its slots
+ * avoids allocating a map node for every message sent.
+ */
+class RequestMap
+{
+public:
+    RequestMap();
+
+    void insert(quint32 requestNo, resmsg_type_t type, qint64 sentAt = 0);
+    bool contains(quint32 requestNo) const;
+    void setAnswered(quint32 requestNo);
+    QList<resmsg_type_t> unansweredSince(qint64 time) const;
+    bool hasUnanswered() const;
+    resmsg_type_t value(quint32 requestNo) const;
+    resmsg_type_t take(quint32 requestNo);
+    void remove(quint32 requestNo);
+    int size() const;
+
+private:
+    struct Entry {
+        quint32 requestNo;
+        resmsg_type_t type;
+        qint64 sentAt;
+        bool answered;
+    };
+
+    int indexOf(quint32 requestNo) const;
+
+    QVector<Entry> entries;
+};
+
 class ResourceEngine: public QObject
 {
     Q_OBJECT
@@ -57,8 +93,11 @@ public:
 
     bool connectToManager();
     bool disconnectFromManager();
+    void abandon();
     bool isConnectedToManager();
     bool isConnectingToManager();
+    bool canSendRequests();
+    bool registrationIsCurrent();
 
     bool acquireResources();
     bool releaseResources();
@@ -69,6 +108,11 @@ public:
 
     bool registerVideoProperties(quint32 pid);
 
+    void cork();
+    void uncork();
+    bool isCorked();
+
+    void setWatchdog(int timeout, int interval);
 
     void handleConnectionIsUp(resconn_t *connection);
 
@@ -79,10 +123,14 @@ public:
 
     void handleStatusMessage(quint32 requestNo);
     void handleError(quint32 requestNo, qint32 code, const char *message);
+    void handleProbeReply(DBusPendingCall *pending);
 
     quint32 id();
     bool toBeDeleted();
 
+    static void setFastExit(bool enable);
+    static bool isFastExit();
+
 signals:
     void resourcesBecameAvailable(quint32 bitmaskOfAvailableResources);
     void resourcesGranted(quint32 bitmaskOfGrantedResources);
@@ -94,21 +142,71 @@ signals:
     void errorCallback(quint32 code, const char* );
     void resourcesReleasedByManager();
     void updateOK(bool);
+    void connectionDegraded(const QStringList &stuckRequests);
+    void requestsTimedOut(const QStringList &stuckRequests);
+
+protected:
+    void timerEvent(QTimerEvent *event);
+
+private slots:
+    void flushCorkedMessages();
+    void armWatchdog();
 
 private:
+    /**
+     * A message held back while the engine is corked, with copies of the
+     * strings it points to.
+     */
+    struct CorkedMessage {
+        resmsg_t message;
+        QByteArray appId;
+        QByteArray group;
+        QByteArray name;
+        QByteArray pattern;
+    };
+
+    bool sendMessage(resmsg_t *message);
+    void trackRequest(quint32 requestNo, resmsg_type_t type);
+    void checkHealth();
+    void sendProbe();
+    void cancelProbe();
+    void handleTimeout(const QStringList &stuckRequests);
+    void reconnect();
+    static void closeConnection();
+
     bool connected;
     ResourceSet *resourceSet;
     DBusConnection *dbusConnection;
     resset_t *libresourceSet;
     quint32 requestId;
-    QMap<quint32, resmsg_type_t> messageMap;
+    RequestMap messageMap;
     QMap<quint32, bool> wasInAcquireMode;
+    QByteArray applicationClass;
     quint32 connectionMode;
     static quint32 libresourceUsers;
     static resconn_t *libresourceConnection;
     quint32 identifier;
     bool aboutToBeDeleted;
     bool isConnecting;
+    bool wasConnected;
+    bool registered;
+    quint32 registeredAll;
+    quint32 registeredOptional;
+    QByteArray acknowledgedAudio;
+    QByteArray sentAudio;
+    quint32 sentAudioRequest;
+    int corkDepth;
+    bool flushScheduled;
+    QVector<CorkedMessage> corkedMessages;
+    int requestTimeout;
+    int probeInterval;
+    int watchdogTimer;
+    int reconnectTimer;
+    int reconnectDelay;
+    bool degraded;
+    qint64 lastActivity;
+    qint64 probeSentAt;
+    DBusPendingCall *probeCall;
 };
 
 }
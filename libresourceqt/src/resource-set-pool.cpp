@@ -0,0 +1,135 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <policy/resource-set-pool.h>
+#include "resource-engine.h"
+
+using namespace ResourcePolicy;
+
+ResourceSetPool::ResourceSetPool(QObject *parent)
+    : QObject(parent), compositions(), refillScheduled(false)
+{
+}
+
+ResourceSetPool::~ResourceSetPool()
+{
+    // The sets still in the pool are children of it.
+}
+
+QString ResourceSetPool::keyOf(const QString &applicationClass, const QList<ResourceType> &resources,
+                               const QList<ResourceType> &optional, SetOptions options)
+{
+    quint32 mask = 0;
+    foreach (ResourceType type, resources)
+        mask |= 1 << type;
+    quint32 optionalMask = 0;
+    foreach (ResourceType type, optional)
+        optionalMask |= 1 << type;
+    return applicationClass + QLatin1Char(':') + QString::number(mask, 16)
+        + QLatin1Char(':') + QString::number(optionalMask & mask, 16)
+        + QLatin1Char(':') + QString::number(int(options), 16);
+}
+
+// The modes go first, the set takes them only before anything else.
+ResourceSet * ResourceSetPool::buildSet(const Composition &composition, QObject *parent)
+{
+    ResourceSet *set = new ResourceSet(composition.applicationClass, parent,
+                                       composition.options.testFlag(AlwaysReply),
+                                       composition.options.testFlag(AutoRelease));
+    if (composition.options.testFlag(ThreadSafe))
+        set->setThreadSafe();
+    if (composition.options.testFlag(PipelinedRequests))
+        set->setPipelinedRequests(true);
+    foreach (ResourceType type, composition.resources) {
+        set->addResource(type);
+        if (composition.optional.contains(type))
+            set->resource(type)->setOptional();
+    }
+    return set;
+}
+
+ResourceSet * ResourceSetPool::createSet(const Composition &composition)
+{
+    ResourceSet *set = buildSet(composition, this);
+    // REGISTER and the audio group go out now, the acquire will not wait.
+    set->initAndConnect();
+    return set;
+}
+
+void ResourceSetPool::reserve(const QString &applicationClass, const QList<ResourceType> &resources,
+                              int count, const QList<ResourceType> &optional, SetOptions options)
+{
+    Composition &composition = compositions[keyOf(applicationClass, resources, optional, options)];
+    composition.applicationClass = applicationClass;
+    composition.resources = resources;
+    composition.optional = optional;
+    composition.options = options;
+    composition.count = qMax(count, 0);
+
+    qCDebug(lcResourceQt, "ResourceSetPool::%s() - %d sets of %s", __FUNCTION__,
+            composition.count, qPrintable(applicationClass));
+    while (composition.sets.size() < composition.count)
+        composition.sets << createSet(composition);
+}
+
+ResourceSet * ResourceSetPool::take(const QString &applicationClass, const QList<ResourceType> &resources,
+                                    const QList<ResourceType> &optional, SetOptions options)
+{
+    QHash<QString, Composition>::iterator it =
+        compositions.find(keyOf(applicationClass, resources, optional, options));
+    if (it == compositions.end() || it->sets.isEmpty()) {
+        qCDebug(lcResourceQt, "ResourceSetPool::%s() - no %s set ready", __FUNCTION__, qPrintable(applicationClass));
+        Composition composition;
+        composition.applicationClass = applicationClass;
+        composition.resources = resources;
+        composition.optional = optional;
+        composition.options = options;
+        return buildSet(composition, NULL);
+    }
+
+    ResourceSet *set = it->sets.takeFirst();
+    set->setParent(NULL);
+
+    // Replace it once the caller's first requests are out.
+    if (!refillScheduled) {
+        refillScheduled = true;
+        QMetaObject::invokeMethod(this, "refill", Qt::QueuedConnection);
+    }
+    return set;
+}
+
+int ResourceSetPool::available(const QString &applicationClass, const QList<ResourceType> &resources,
+                               const QList<ResourceType> &optional, SetOptions options) const
+{
+    QHash<QString, Composition>::const_iterator it =
+        compositions.find(keyOf(applicationClass, resources, optional, options));
+    return it == compositions.end() ? 0 : it->sets.size();
+}
+
+void ResourceSetPool::refill()
+{
+    refillScheduled = false;
+    QHash<QString, Composition>::iterator it;
+    for (it = compositions.begin(); it != compositions.end(); ++it) {
+        while (it->sets.size() < it->count)
+            it->sets << createSet(*it);
+    }
+}
@@ -22,33 +22,61 @@ USA.
 #include "resource-engine.h"
 using namespace ResourcePolicy;
 
-static quint32 resourceSetId=1;
+static QAtomicInt resourceSetId(1);
 
+/**
+ * State added after the first release, kept out of ResourceSet so the
+ * exported class keeps its size and layout.
+ */
 class ResourceSetPrivate
 {
 public:
-    ResourceSetPrivate();
+    ResourceSetPrivate()
+        : pipelined(false), threadSafe(false), lazy(false), sentRequests(0), corkDepth(0),
+          adviceMask(0), pendingAdvice(0), lastAdvice(0), adviceScheduled(false),
+          timeoutMsecs(0), probeMsecs(0), fixedComposition(false),
+          fixedAllMask(0), fixedOptionalMask(0) {}
+
+    bool pipelined;
+    bool threadSafe;
+    bool lazy;
+    int sentRequests;
+    int corkDepth;
+    quint32 adviceMask;
+    quint32 pendingAdvice;
+    quint32 lastAdvice;
+    bool adviceScheduled;
+    int timeoutMsecs;
+    int probeMsecs;
+    // Read by the engine without reqMutex: the masks are written once,
+    // before the flag is raised.
+    QAtomicInt fixedComposition;
+    quint32 fixedAllMask;
+    quint32 fixedOptionalMask;
 };
+
 ResourceSet::ResourceSet(const QString &applicationClass, QObject * parent,
                          bool initialAlwaysReply, bool initialAutoRelease)
     : QObject(parent), resourceClass(applicationClass), resourceEngine(NULL),
-      audioResource(NULL), autoRelease(initialAutoRelease),
+      audioResource(NULL), videoResource(NULL), autoRelease(initialAutoRelease),
       alwaysReply(initialAlwaysReply), initialized(false), pendingAcquire(false),
       pendingUpdate(false), pendingAudioProperties(false), pendingVideoProperties(false),
-      inAcquireMode(false), reqMutex(QMutex::Recursive), ignoreQ(false)
+      inAcquireMode(false), reqMutex(QMutex::Recursive), ignoreQ(false),
+      d(new ResourceSetPrivate)
 {
-    identifier = resourceSetId++;
+    identifier = resourceSetId.fetchAndAddRelaxed(1);
     memset(resourceSet, 0, sizeof(Resource *)*NumberOfTypes);
 }
 
 ResourceSet::ResourceSet(const QString &applicationClass, QObject * parent)
     : QObject(parent), resourceClass(applicationClass), resourceEngine(NULL),
-      audioResource(NULL), autoRelease(false),
+      audioResource(NULL), videoResource(NULL), autoRelease(false),
       alwaysReply(false), initialized(false), pendingAcquire(false),
       pendingUpdate(false), pendingAudioProperties(false), pendingVideoProperties(false),
-      inAcquireMode(false), reqMutex(QMutex::Recursive), ignoreQ(false)
+      inAcquireMode(false), reqMutex(QMutex::Recursive), ignoreQ(false),
+      d(new ResourceSetPrivate)
 {
-    identifier = resourceSetId++;
+    identifier = resourceSetId.fetchAndAddRelaxed(1);
     memset(resourceSet, 0, sizeof(Resource *)*NumberOfTypes);
 }
 
@@ -58,11 +86,16 @@ ResourceSet::~ResourceSet()
     for (int i = 0;i < NumberOfTypes;i++) {
         delete resourceSet[i];
     }
-    if (resourceEngine != NULL) {
+    if (resourceEngine != NULL && ResourceEngine::isFastExit()) {
+        qCDebug(lcResourceQt, "ResourceSet::%s(%d) - fast exit, not unregistering", __FUNCTION__, identifier);
+        resourceEngine->disconnect(this);
+        resourceEngine->abandon();
+    } else if (resourceEngine != NULL) {
         qCDebug(lcResourceQt, "ResourceSet::%s(%d) - resourceEngine->disconnectFromManager()", __FUNCTION__, identifier);
         resourceEngine->disconnect(this);
         resourceEngine->disconnectFromManager();
     }
+    delete d;
     qCDebug(lcResourceQt, "ResourceSet::%s(%d) - deleted!", __FUNCTION__, identifier);
 }
 
@@ -70,24 +103,37 @@ bool ResourceSet::initialize()
 {
     resourceEngine = new ResourceEngine(this);
 
+    // A thread-safe set handles the replies from its own event loop, never
+    // from inside the engine callbacks that hold the engine lock.
+    Qt::ConnectionType type = d->threadSafe ? Qt::QueuedConnection : Qt::AutoConnection;
+    if (d->threadSafe)
+        resourceEngine->moveToThread(thread());
+
     QObject::connect(resourceEngine, SIGNAL(connectedToManager()),
-                     this, SLOT(connectedHandler()));
+                     this, SLOT(connectedHandler()), type);
     QObject::connect(resourceEngine, SIGNAL(resourcesGranted(quint32)),
-                     this, SLOT(handleGranted(quint32)));
+                     this, SLOT(handleGranted(quint32)), type);
     QObject::connect(resourceEngine, SIGNAL(resourcesDenied()),
-                     this, SLOT(handleDeny()));
+                     this, SLOT(handleDeny()), type);
     QObject::connect(resourceEngine, SIGNAL(resourcesReleased()),
-                     this, SLOT(handleReleased()));
+                     this, SLOT(handleReleased()), type);
     QObject::connect(resourceEngine, SIGNAL(resourcesLost(quint32)),
-                     this, SLOT(handleResourcesLost(quint32)));
+                     this, SLOT(handleResourcesLost(quint32)), type);
     QObject::connect(resourceEngine, SIGNAL(resourcesBecameAvailable(quint32)),
-                     this, SLOT(handleResourcesBecameAvailable(quint32)));
+                     this, SLOT(handleResourcesBecameAvailable(quint32)), type);
     QObject::connect(resourceEngine, SIGNAL(errorCallback(quint32, const char*)),
-                     this, SIGNAL(errorCallback(quint32, const char*)));
+                     this, SIGNAL(errorCallback(quint32, const char*)), type);
     QObject::connect(resourceEngine, SIGNAL(resourcesReleasedByManager()),
-                     this, SLOT(handleReleasedByManager()));
+                     this, SLOT(handleReleasedByManager()), type);
     QObject::connect(resourceEngine, SIGNAL(updateOK(bool)),
-                     this, SLOT(handleUpdateOK(bool)));
+                     this, SLOT(handleUpdateOK(bool)), type);
+    QObject::connect(resourceEngine, SIGNAL(connectionDegraded(const QStringList &)),
+                     this, SIGNAL(managerDegraded(const QStringList &)), type);
+    QObject::connect(resourceEngine, SIGNAL(requestsTimedOut(const QStringList &)),
+                     this, SLOT(handleRequestsTimedOut(const QStringList &)), type);
+
+    for (int i = 0; i < d->corkDepth; i++)
+        resourceEngine->cork();
 
     qCDebug(lcResourceQt) << QString("initializing resource engine...");
     if (!resourceEngine->initialize()) {
@@ -99,6 +145,7 @@ bool ResourceSet::initialize()
     }
     qCDebug(lcResourceQt, "ResourceSet is initialized engine:%d", resourceEngine->id());
     initialized = true;
+    sendPendingRequests();
     qCDebug(lcResourceQt, "**************** ResourceSet::%s().... %d", __FUNCTION__, __LINE__);
     return true;
 }
@@ -108,9 +155,21 @@ void ResourceSet::addResourceObject(Resource *resource)
     qCDebug(lcResourceQt, "**************** ResourceSet::%s(%d).... %d", __FUNCTION__, this->id(), __LINE__);
     if (resource == NULL)
         return;
+    if (isForeignThread()) {
+        // Applied by the set's own thread, in order with the requests.
+        if (resource->type() == AudioPlaybackType)
+            static_cast<AudioResource *>(resource)->moveToThread(thread());
+        else if (resource->type() == VideoPlaybackType)
+            static_cast<VideoResource *>(resource)->moveToThread(thread());
+        QMetaObject::invokeMethod(this, "addForwardedResource", Qt::QueuedConnection,
+                                  Q_ARG(void *, resource));
+        return;
+    }
     qCDebug(lcResourceQt, "**************** ResourceSet::%s(%d).... %d", __FUNCTION__, this->id(), __LINE__);
+    QMutexLocker locker(&reqMutex);
     delete resourceSet[resource->type()];
     resourceSet[resource->type()] = resource;
+    d->fixedComposition.storeRelease(0);
 
     if ( resource->type() == AudioPlaybackType ) {
 
@@ -209,15 +268,30 @@ bool ResourceSet::addResource(ResourceType type)
     return true;
 }
 
+void ResourceSet::addForwardedResource(void *resource)
+{
+    addResourceObject(static_cast<Resource *>(resource));
+}
+
 void ResourceSet::deleteResource(ResourceType type)
 {
+    if (isForeignThread()) {
+        QMetaObject::invokeMethod(this, "deleteForwardedResource", Qt::QueuedConnection,
+                                  Q_ARG(int, type));
+        return;
+    }
+    QMutexLocker locker(&reqMutex);
     if (type == AudioPlaybackType) {
         audioResource->disconnect();
         audioResource = NULL;
         pendingAudioProperties = false;
+    } else if (type == VideoPlaybackType) {
+        videoResource = NULL;
+        pendingVideoProperties = false;
     }
     delete resourceSet[type];
     resourceSet[type] = NULL;
+    d->fixedComposition.storeRelease(0);
 
     if (resourceEngine
         && (resourceEngine->isConnectedToManager() || resourceEngine->isConnectingToManager())) {
@@ -226,8 +300,59 @@ void ResourceSet::deleteResource(ResourceType type)
 
 }
 
+void ResourceSet::deleteForwardedResource(int type)
+{
+    deleteResource((ResourceType)type);
+}
+
+void ResourceSet::setFixedComposition(quint32 allTypes, quint32 optionalTypes)
+{
+    QMutexLocker locker(&reqMutex);
+    quint32 all = 0;
+    quint32 optional = 0;
+    for (int i = 0; i < NumberOfTypes; i++) {
+        if (!(allTypes & (1 << i)))
+            continue;
+        ResourceType type = (ResourceType)i;
+        addResource(type);
+        quint32 bits = resourceTypeToLibresourceType(type);
+        all |= bits;
+        if (optionalTypes & (1 << i)) {
+            resourceSet[i]->setOptional();
+            optional |= bits;
+        }
+    }
+    d->fixedAllMask = all;
+    d->fixedOptionalMask = optional;
+    d->fixedComposition.storeRelease(1);
+    qCDebug(lcResourceQt, "ResourceSet::%s(%d) all=0x%04x optional=0x%04x", __FUNCTION__, identifier, all, optional);
+}
+
+void ResourceSet::setFastExit(bool enable)
+{
+    ResourceEngine::setFastExit(enable);
+}
+
+bool ResourceSet::fastExit()
+{
+    return ResourceEngine::isFastExit();
+}
+
+bool ResourceSet::fixedBitmasks(quint32 *all, quint32 *optional) const
+{
+    // No reqMutex: the engine asks while holding its own mutex.
+    if (!d->fixedComposition.loadAcquire())
+        return false;
+    if (all != NULL)
+        *all = d->fixedAllMask;
+    if (optional != NULL)
+        *optional = d->fixedOptionalMask;
+    return true;
+}
+
 bool ResourceSet::contains(ResourceType type) const
 {
+    QMutexLocker locker(&reqMutex);
     return ((type < NumberOfTypes) && (resourceSet[type] != NULL));
 }
 
@@ -259,6 +384,7 @@ quint32 ResourceSet::id() const
 
 QList<Resource *> ResourceSet::resources() const
 {
+    QMutexLocker locker(&reqMutex);
     QList<Resource *> listOfResources;
     for (int i = 0; i < NumberOfTypes; i++) {
         if (resourceSet[i] != NULL) {
@@ -270,18 +396,25 @@ QList<Resource *> ResourceSet::resources() const
 
 Resource * ResourceSet::resource(ResourceType type) const
 {
+    QMutexLocker locker(&reqMutex);
     return resourceSet[type];
 }
 
 bool ResourceSet::initAndConnect()
 {
+    if (isForeignThread())
+        return QMetaObject::invokeMethod(this, "initAndConnect", Qt::QueuedConnection);
+    QMutexLocker locker(&reqMutex);
+
     if (!initialized) {
         qCDebug(lcResourceQt, "ResourceSet::%s().... initializing...", __FUNCTION__);
         return initialize();
     }
     if (!resourceEngine->isConnectedToManager()) {
         qCDebug(lcResourceQt, "ResourceSet::%s().... connecting...", __FUNCTION__);
-        return resourceEngine->connectToManager();
+        if (!resourceEngine->connectToManager())
+            return false;
+        sendPendingRequests();
     } else {
         qCDebug(lcResourceQt, "ResourceSet::%s(): already connected", __FUNCTION__);
     }
@@ -292,47 +425,84 @@ bool ResourceSet::initAndConnect()
 
 bool ResourceSet::proceedIfImFirst( requestType theRequest )
 {
-    if (!ignoreQ) {
-        requestQ.push_back(theRequest);
-    } else {
+    if (ignoreQ) {
         qCDebug(lcResourceQt, "ResourceSet::%s()...executing first request of %d.", __FUNCTION__, requestQ.size() );
         return true;
     }
 
-    //Execute if this is the first request or the next is run from slot.
-    if (requestQ.size() == 1 ) {
-        if (!ignoreQ) { qCDebug(lcResourceQt, "ResourceSet::%s()...allowing only request directly.", __FUNCTION__); }
+    //A release overtakes the requests still waiting in the queue, and the
+    //acquires among them are dropped: they would only be released again.
+    //It is sent at once so the manager can hand the resources on. Acquires
+    //already sent are superseded too; their reply may never come, as a set
+    //without alwaysReply hears nothing about a grant of no resources.
+    if (theRequest == Release) {
+        for (int i = requestQ.size() - 1; i >= 0; i--) {
+            if (requestQ.at(i) != Acquire)
+                continue;
+            if (i < d->sentRequests) {
+                qCDebug(lcResourceQt, "ResourceSet::%s()...superseding sent request:Acquire.", __FUNCTION__);
+                d->sentRequests--;
+            } else {
+                qCDebug(lcResourceQt, "ResourceSet::%s()...cancelling queued request:Acquire.", __FUNCTION__);
+            }
+            requestQ.removeAt(i);
+        }
+        requestQ.insert(d->sentRequests++, Release);
+        qCDebug(lcResourceQt, "ResourceSet::%s()...sending request:Release ahead of %d.",
+                __FUNCTION__, requestQ.size() - d->sentRequests);
         return true;
     }
 
-    if (requestQ.size() > 1) {
-        qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request %d.", __FUNCTION__, requestQ.size());
+    requestQ.push_back(theRequest);
 
-        switch (theRequest)
-        {
-        case Acquire:  qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request:Acquire.", __FUNCTION__); break;
-        case Update:   qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request:Update.", __FUNCTION__);  break;
-        case Release:  qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request:Release.", __FUNCTION__); break;
-        }
-        return false;
+    //Pipelined requests go out at once, the queue only keeps their order.
+    if (d->pipelined) {
+        qCDebug(lcResourceQt, "ResourceSet::%s()...pipelining request %d.", __FUNCTION__, requestQ.size());
+        d->sentRequests++;
+        return true;
     }
 
-    Q_ASSERT_X(0, "proceedIfImFirst", "request queue can not be empty.");
+    //Execute if this is the first request or the next is run from slot.
+    if (requestQ.size() == 1 ) {
+        qCDebug(lcResourceQt, "ResourceSet::%s()...allowing only request directly.", __FUNCTION__);
+        d->sentRequests++;
+        return true;
+    }
+
+    qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request %d.", __FUNCTION__, requestQ.size());
 
+    switch (theRequest)
+    {
+    case Acquire:  qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request:Acquire.", __FUNCTION__); break;
+    case Update:   qCDebug(lcResourceQt, "ResourceSet::%s()...queuing request:Update.", __FUNCTION__);  break;
+    case Release:  break;
+    }
     return false;
 }
 
 
-void ResourceSet::executeNextRequest()
+void ResourceSet::executeNextRequest(requestType answered)
 {
     qCDebug(lcResourceQt) << Q_FUNC_INFO;
 
-    if (requestQ.isEmpty()) {
+    //Remove the oldest sent request the reply is for. Replies need not come
+    //in the order the requests were sent, and one nobody waits for is dropped.
+    int completed = 0;
+    while (completed < d->sentRequests && requestQ.at(completed) != answered)
+        completed++;
+
+    if (completed == d->sentRequests) {
         qCDebug(lcResourceQt) << Q_FUNC_INFO << QString("...the completed request is not present.");
         return;
     }
 
-    requestQ.removeFirst(); //Remove completed request.
+    requestQ.removeAt(completed);
+    d->sentRequests--;
+
+    if (d->sentRequests > 0) {
+        //The following request is on its way already.
+        return;
+    }
 
     if (requestQ.isEmpty()) {
         qCDebug(lcResourceQt) << Q_FUNC_INFO << QString("...last request acknowledged and removed.");
@@ -340,6 +510,7 @@ void ResourceSet::executeNextRequest()
     }
 
     requestType nxtReq = requestQ.at(0);
+    d->sentRequests++;
 
     //Ensure that proceedIfimFirst() lets through.
     ignoreQ = true;
@@ -363,7 +534,11 @@ void ResourceSet::executeNextRequest()
 
 bool ResourceSet::acquire()
 {
-    if (!initialized || !resourceEngine->isConnectedToManager()) {
+    if (isForeignThread())
+        return QMetaObject::invokeMethod(this, "acquire", Qt::QueuedConnection);
+    QMutexLocker locker(&reqMutex);
+
+    if (!initialized || !resourceEngine->canSendRequests()) {
         pendingAcquire = true;
         return initAndConnect();
     } else {
@@ -388,7 +563,12 @@ bool ResourceSet::acquire()
 
 bool ResourceSet::release()
 {
-    if (!initialized || !resourceEngine->isConnectedToManager()) {
+    if (isForeignThread())
+        return QMetaObject::invokeMethod(this, "release", Qt::QueuedConnection);
+    QMutexLocker locker(&reqMutex);
+
+    if (!initialized || !resourceEngine->canSendRequests()) {
+        pendingAcquire = false;
         return true;
     }
 
@@ -401,13 +581,30 @@ bool ResourceSet::release()
 
 bool ResourceSet::update()
 {
+    if (isForeignThread())
+        return QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+    QMutexLocker locker(&reqMutex);
+
     if (!initialized) {
-        return true;
+        // A lazy set connects now, its REGISTER carries the resources.
+        return d->lazy ? initialize() : true;
     }
 
-    if (!resourceEngine->isConnectedToManager()) {
+    if (!resourceEngine->canSendRequests()) {
         pendingUpdate = true;
         resourceEngine->connectToManager();
+        sendPendingRequests();
+        return true;
+    }
+
+    // With nothing granted and nothing outstanding, the manager would only
+    // acknowledge an update that changes nothing: complete it right here.
+    // A set holding resources always asks, its reply is a grant or a loss.
+    if (requestQ.isEmpty() && !inAcquireMode && resourceEngine->registrationIsCurrent()) {
+        qCDebug(lcResourceQt) << Q_FUNC_INFO << QString("... set unchanged, update elided");
+        pendingUpdate = false;
+        if (alwaysReply)
+            emit updateOK();
         return true;
     }
 
@@ -417,6 +614,120 @@ bool ResourceSet::update()
     return resourceEngine->updateResources();
 }
 
+void ResourceSet::cork()
+{
+    d->corkDepth++;
+    if (resourceEngine != NULL)
+        resourceEngine->cork();
+}
+
+void ResourceSet::uncork()
+{
+    if (d->corkDepth == 0)
+        return;
+
+    d->corkDepth--;
+    if (resourceEngine != NULL)
+        resourceEngine->uncork();
+}
+
+bool ResourceSet::isCorked() const
+{
+    return d->corkDepth > 0;
+}
+
+bool ResourceSet::setPipelinedRequests(bool enabled)
+{
+    QMutexLocker locker(&reqMutex);
+    if (!requestQ.isEmpty())
+        return false;
+    d->pipelined = enabled;
+    return true;
+}
+
+bool ResourceSet::pipelinedRequests() const
+{
+    QMutexLocker locker(&reqMutex);
+    return d->pipelined;
+}
+
+bool ResourceSet::setThreadSafe()
+{
+    if (initialized)
+        return false;
+    d->threadSafe = true;
+    return true;
+}
+
+bool ResourceSet::isThreadSafe() const
+{
+    return d->threadSafe;
+}
+
+void ResourceSet::setAdviceResources(const QList<ResourceType> &types)
+{
+    QMutexLocker locker(&reqMutex);
+    d->adviceMask = 0;
+    foreach (ResourceType type, types)
+        d->adviceMask |= resourceTypeToLibresourceType(type);
+    d->lastAdvice = 0;
+}
+
+QList<ResourceType> ResourceSet::adviceResources() const
+{
+    QMutexLocker locker(&reqMutex);
+    QList<ResourceType> types;
+    for (int i = 0; i < NumberOfTypes; i++) {
+        if (d->adviceMask & resourceTypeToLibresourceType((ResourceType)i))
+            types << (ResourceType)i;
+    }
+    return types;
+}
+
+void ResourceSet::setRequestTimeout(int msecs)
+{
+    QMutexLocker locker(&reqMutex);
+    d->timeoutMsecs = qMax(msecs, 0);
+    if (resourceEngine != NULL)
+        resourceEngine->setWatchdog(d->timeoutMsecs, d->probeMsecs);
+}
+
+int ResourceSet::requestTimeout() const
+{
+    return d->timeoutMsecs;
+}
+
+void ResourceSet::setProbeInterval(int msecs)
+{
+    QMutexLocker locker(&reqMutex);
+    d->probeMsecs = qMax(msecs, 0);
+    if (resourceEngine != NULL)
+        resourceEngine->setWatchdog(d->timeoutMsecs, d->probeMsecs);
+}
+
+int ResourceSet::probeInterval() const
+{
+    return d->probeMsecs;
+}
+
+bool ResourceSet::setLazy()
+{
+    if (initialized)
+        return false;
+    d->lazy = true;
+    return true;
+}
+
+bool ResourceSet::isLazy() const
+{
+    return d->lazy;
+}
+
+bool ResourceSet::isForeignThread() const
+{
+    return d->threadSafe && QThread::currentThread() != thread();
+}
+
 QString ResourceSet::applicationClass()
 {
     return this->resourceClass;
@@ -450,62 +761,128 @@ bool ResourceSet::alwaysGetReply()
 
 void ResourceSet::connectedHandler()
 {
+    QMutexLocker locker(&reqMutex);
     qCDebug(lcResourceQt, "**************** ResourceSet::%s().... %d", __FUNCTION__, __LINE__);
     if (resourceEngine->isConnectedToManager()) {
         qCDebug(lcResourceQt, "ResourceSet::%s() Connected to manager!", __FUNCTION__);
         emit managerIsUp();
 
-        if (pendingAudioProperties) {
-            registerAudioProperties();
-        }
-        if (pendingVideoProperties) {
-            registerVideoProperties();
-        }
-        if (pendingUpdate) {
-            resourceEngine->updateResources();
-            pendingUpdate = false;
-        }
-        if (pendingAcquire) {
-            acquire();
-            pendingAcquire = false;
-        }
+        // Most requests went out right behind the REGISTER, this picks
+        // up whatever was added while it was in flight.
+        sendPendingRequests();
+    } else if (resourceEngine->isConnectingToManager()) {
+        // The REGISTER is on its way, with the requests pipelined behind it.
+        sendPendingRequests();
     } else { // assuming reconnecting
         qCDebug(lcResourceQt, "ResourceSet::%s() Reconnecting to manager...", __FUNCTION__);
 
-        // first check if we have any acquired resources
+        // Whatever was granted, or was about to be acquired, is acquired
+        // again. The queued requests went to the previous manager and will
+        // never be answered.
+        bool reacquire = false;
         for (int i = 0; i < NumberOfTypes; i++) {
-            if (resourceSet[i] != NULL) {
-                if (resourceSet[i]->isGranted()) {
-
-                    if (i == AudioPlaybackType) {
-                        pendingAudioProperties = true;
-                        qCDebug(lcResourceQt, "ResourceSet::%s() We have audio", __FUNCTION__);
-                    }
-
-                    if (i == VideoPlaybackType) {
-                        pendingVideoProperties = true;
-                        qCDebug(lcResourceQt, "ResourceSet::%s() We have video", __FUNCTION__);
-                    }
-
-                    qCDebug(lcResourceQt, "ResourceSet::%s() We have acquired resources. Re-acquire", __FUNCTION__);
-                    pendingAcquire = true;
-                    resourceSet[i]->unsetGranted();
-                }
+            if (resourceSet[i] != NULL && resourceSet[i]->isGranted()) {
+                qCDebug(lcResourceQt, "ResourceSet::%s() We have acquired resources. Re-acquire", __FUNCTION__);
+                reacquire = true;
+                resourceSet[i]->unsetGranted();
             }
         }
+        for (int i = requestQ.size() - 1; i >= 0; i--) {
+            if (requestQ.at(i) != Update) {
+                reacquire = requestQ.at(i) == Acquire;
+                break;
+            }
+        }
+        requestQ.clear();
+        d->sentRequests = 0;
+        pendingAcquire = pendingAcquire || reacquire;
+
+        // The REGISTER carries the current resources, the properties are
+        // replayed from what the set has cached.
+        pendingUpdate = false;
+        if (audioResource != NULL && audioResource->audioGroupIsSet()) {
+            qCDebug(lcResourceQt, "ResourceSet::%s() We have audio", __FUNCTION__);
+            pendingAudioProperties = true;
+        }
+        if (videoResource != NULL && videoResource->processID() > 0) {
+            qCDebug(lcResourceQt, "ResourceSet::%s() We have video", __FUNCTION__);
+            pendingVideoProperties = true;
+        }
+
         // now reconnect
         resourceEngine->connectToManager();
+        sendPendingRequests();
+    }
+}
+
+void ResourceSet::handleRequestsTimedOut(const QStringList &stuckRequests)
+{
+    QMutexLocker locker(&reqMutex);
+    qCDebug(lcResourceQt, "ResourceSet::%s() manager timed out: %s", __FUNCTION__,
+            qPrintable(stuckRequests.join(",")));
+
+    // The engine dropped its registration and registers again once it has
+    // backed off. Until then requests only set the pending flags, so the
+    // queue is settled here: what was held or about to be acquired is
+    // acquired again, unless a release came last.
+    bool reacquire = false;
+    for (int i = 0; i < NumberOfTypes; i++) {
+        if (resourceSet[i] != NULL && resourceSet[i]->isGranted()) {
+            reacquire = true;
+            resourceSet[i]->unsetGranted();
+        }
+    }
+    for (int i = requestQ.size() - 1; i >= 0; i--) {
+        if (requestQ.at(i) != Update) {
+            reacquire = requestQ.at(i) == Acquire;
+            break;
+        }
+    }
+    requestQ.clear();
+    d->sentRequests = 0;
+    pendingAcquire = pendingAcquire || reacquire;
+
+    emit managerTimedOut(stuckRequests);
+}
+
+void ResourceSet::sendPendingRequests()
+{
+    if (!resourceEngine->canSendRequests())
+        return;
+
+    // One burst right behind the REGISTER, so that a cold acquire() costs
+    // a single round-trip.
+    ResourceSetCork cork(this);
+
+    if (pendingAudioProperties) {
+        registerAudioProperties();
+    }
+    if (pendingVideoProperties) {
+        registerVideoProperties();
+    }
+    if (pendingUpdate) {
+        // An add and a delete may have cancelled each other out.
+        if (!resourceEngine->registrationIsCurrent())
+            resourceEngine->updateResources();
+        pendingUpdate = false;
+    }
+    if (pendingAcquire) {
+        pendingAcquire = false;
+        acquire();
     }
 }
 
 void ResourceSet::registerAudioProperties()
 {
+    QMutexLocker locker(&reqMutex);
     if (!initialized) {
-        qCDebug(lcResourceQt, "%s(): initializing...", __FUNCTION__);
         pendingAudioProperties = true;
+        if (d->lazy)
+            return;
+        qCDebug(lcResourceQt, "%s(): initializing...", __FUNCTION__);
         initialize();
         return;
-    } else if (resourceEngine->isConnectedToManager()) {
+    } else if (resourceEngine->canSendRequests()) {
         qCDebug(lcResourceQt, "Registering new audio settings");
         //qCDebug(lcResourceQt,  "\taudio group: %s", audioResource->audioGroup().toStdString().c_str() );
         //qCDebug(lcResourceQt,  "\tPID: %d ", audioResource->processID() );
@@ -527,18 +904,22 @@ void ResourceSet::registerAudioProperties()
 
         pendingAudioProperties = true;
         resourceEngine->connectToManager();
+        sendPendingRequests();
         return;
     }
 }
 
 void ResourceSet::registerVideoProperties()
 {
+    QMutexLocker locker(&reqMutex);
     if (!initialized) {
-        qCDebug(lcResourceQt, "%s(): initializing...", __FUNCTION__);
         pendingVideoProperties = true;
+        if (d->lazy)
+            return;
+        qCDebug(lcResourceQt, "%s(): initializing...", __FUNCTION__);
         initialize();
         return;
-    } else if (resourceEngine->isConnectedToManager()) {
+    } else if (resourceEngine->canSendRequests()) {
 
         qCDebug(lcResourceQt, "Registering new video settings:");
         qCDebug(lcResourceQt, "\tPID:%d", videoResource->processID() );
@@ -557,12 +938,15 @@ void ResourceSet::registerVideoProperties()
 
         pendingVideoProperties = true;
         resourceEngine->connectToManager();
+        sendPendingRequests();
         return;
     }
 }
 
 void ResourceSet::handleGranted(quint32 bitmaskOfGrantedResources)
 {
+    QMutexLocker locker(&reqMutex);
+    d->lastAdvice = 0;
     qCDebug(lcResourceQt, " ResourceSet::%s",__FUNCTION__);
     QList<ResourceType> optionalResources;
     qCDebug(lcResourceQt, "Acquired resources: 0x%04x", bitmaskOfGrantedResources);
@@ -602,11 +986,13 @@ void ResourceSet::handleGranted(quint32 bitmaskOfGrantedResources)
     }
 
     inAcquireMode = true;
-    executeNextRequest();
+    executeNextRequest(Acquire);
 }
 
 void ResourceSet::handleReleased()
 {
+    QMutexLocker locker(&reqMutex);
+    d->lastAdvice = 0;
     for (int i=0;i < NumberOfTypes; i++) {
         if (resourceSet[i] != NULL) {
             resourceSet[i]->unsetGranted();
@@ -619,26 +1005,30 @@ void ResourceSet::handleReleased()
     qCDebug(lcResourceQt, "ResourceSet(%d) - resourcesReleased!", identifier);
     inAcquireMode = false;
 
-    executeNextRequest();
+    executeNextRequest(Release);
     //emit resourcesReleased();
 }
 
 void ResourceSet::handleDeny()
 {
+    QMutexLocker locker(&reqMutex);
+    d->lastAdvice = 0;
     for (int i=0;i < NumberOfTypes; i++) {
         if (resourceSet[i] != NULL) {
             resourceSet[i]->unsetGranted();
         }
     }
-    executeNextRequest();
+    executeNextRequest(Acquire);
     emit resourcesDenied();
 }
 
 void ResourceSet::handleResourcesLost(quint32 lostResourcesBitmask)
 {
+    QMutexLocker locker(&reqMutex);
+    d->lastAdvice = 0;
     for (int i=0;i < NumberOfTypes; i++) {
         quint32 bitmask = resourceTypeToLibresourceType((ResourceType)i);
-        if ((bitmask & lostResourcesBitmask) == bitmask) {
+        if (resourceSet[i] != NULL && (bitmask & lostResourcesBitmask) == bitmask) {
             resourceSet[i]->unsetGranted();
             qCDebug(lcResourceQt, "Resource %04x is now lost", bitmask);
         }
@@ -646,16 +1036,45 @@ void ResourceSet::handleResourcesLost(quint32 lostResourcesBitmask)
 
     //All requests are invalid when we are pre-empted.
     requestQ.clear();
+    d->sentRequests = 0;
     if (inAcquireMode) emit lostResources();
 }
 
 void ResourceSet::handleResourcesBecameAvailable(quint32 availableResources)
 {
+    QMutexLocker locker(&reqMutex);
+    if (d->adviceMask != 0)
+        availableResources &= d->adviceMask;
+
+    // Nothing to do if nobody listens or the advice is not of interest.
+    if (availableResources == 0
+        || receivers(SIGNAL(resourcesBecameAvailable(const QList<ResourcePolicy::ResourceType> &))) == 0) {
+        return;
+    }
+
+    d->pendingAdvice = availableResources;
+    if (!d->adviceScheduled) {
+        d->adviceScheduled = true;
+        QMetaObject::invokeMethod(this, "deliverAdvice", Qt::QueuedConnection);
+    }
+}
+
+void ResourceSet::deliverAdvice()
+{
+    QMutexLocker locker(&reqMutex);
+    d->adviceScheduled = false;
+
+    if (d->pendingAdvice == d->lastAdvice) {
+        qCDebug(lcResourceQt, "ResourceSet(%d) - ignoring repeated advice 0x%04x", identifier, d->pendingAdvice);
+        return;
+    }
+    d->lastAdvice = d->pendingAdvice;
+
     QList<ResourceType> listOfResources;
     for (int i=0;i < NumberOfTypes; i++) {
         ResourceType type = (ResourceType)i;
         quint32 bitmask = resourceTypeToLibresourceType(type);
-        if ((bitmask & availableResources) == bitmask) {
+        if ((bitmask & d->lastAdvice) == bitmask) {
             listOfResources.append(type);
         }
     }
@@ -675,8 +1094,10 @@ void ResourceSet::handleVideoPropertiesChanged( quint32)
 
 void ResourceSet::handleReleasedByManager()
 {
+    QMutexLocker locker(&reqMutex);
     //All requests are invalid when we are pre-empted.
    requestQ.clear();
+   d->sentRequests = 0;
 
    resourceEngine->releaseResources();
    inAcquireMode = false;
@@ -685,6 +1106,7 @@ void ResourceSet::handleReleasedByManager()
 
 void ResourceSet::handleUpdateOK(bool resend)
 {
+    QMutexLocker locker(&reqMutex);
     pendingUpdate = false;
     qCDebug(lcResourceQt, "ResourceSet::%s().... %d", __FUNCTION__, __LINE__);
 
@@ -705,5 +1127,5 @@ void ResourceSet::handleUpdateOK(bool resend)
     }
 
     qCDebug(lcResourceQt, "ResourceSet::%s()...about to exe next request....", __FUNCTION__);
-    executeNextRequest();
+    executeNextRequest(Update);
 }
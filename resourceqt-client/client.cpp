@@ -23,6 +23,8 @@ USA.
 #include <QtCore/QFile>
 #include <QTextStream>
 
+#include <algorithm>
+
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/select.h>
@@ -34,6 +36,7 @@ USA.
 
 using namespace ResourcePolicy;
 
+const char *Client::defaultSetName = "default";
 QMap<QString, CommandListArgs> Client::commandList;
 
 CommandListArgs::CommandListArgs()
@@ -51,26 +54,55 @@ CommandListArgs::~CommandListArgs()
 {
 }
 
+ClientSet::ClientSet()
+        : name(), applicationClass(), resourceSet(NULL), pendingAddAudio(false)
+{
+    timer.tv_sec = 0;
+    timer.tv_nsec = 0;
+}
+
+ClientSet::ClientSet(const QString &setName, const QString &setClass,
+                     ResourcePolicy::ResourceSet *set)
+        : name(setName), applicationClass(setClass), resourceSet(set), pendingAddAudio(false)
+{
+    timer.tv_sec = 0;
+    timer.tv_nsec = 0;
+}
+
+static bool eventIsEarlier(const ClientEvent &a, const ClientEvent &b)
+{
+    return a.timestamp < b.timestamp;
+}
+
 Client::Client()
-        : QObject(), standardInput(stdin, QIODevice::ReadOnly), stdInNotifier(0, QSocketNotifier::Read), pendingAddAudio(false), applicationClass(),
-        resourceSet(NULL), output(stdout), prefix(""), showTimings(false)
+        : QObject(), standardInput(stdin, QIODevice::ReadOnly), stdInNotifier(0, QSocketNotifier::Read),
+        sets(), currentSet(), output(stdout), prefix(""), showTimings(false), fastExit(false),
+        eventLog()
 {
     commandList["help"] = CommandListArgs("", "print this help message");
     commandList["quit"] = CommandListArgs("", "exit application");
-    commandList["free"] = CommandListArgs("", "destroy and free the resources");
-    commandList["acquire"] = CommandListArgs("", "acquire required resources");
-    commandList["release"] = CommandListArgs("", "release resources");
-    commandList["update"] = CommandListArgs("update <all>[:opt] where 'all' and 'opt' are comma separated resources",
+    commandList["free"] = CommandListArgs("[set]", "destroy and free the resources");
+    commandList["acquire"] = CommandListArgs("[set]", "acquire required resources");
+    commandList["release"] = CommandListArgs("[set]", "release resources");
+    commandList["update"] = CommandListArgs("update <all>[:opt] [set] where 'all' and 'opt' are comma separated resources",
                                                "update the resource set by specifying the new set");
     commandList["audio"] = CommandListArgs("pid <pid> | group <audio group> | tag <name> <value>", "set audio properties");
     commandList["addaudio"] = CommandListArgs("<audio group> <pid> <tag name> <tag value>", "Add an audio resource and set the properties");
-    commandList["show"] = CommandListArgs("", "show resources");
-
+    commandList["show"] = CommandListArgs("[set]", "show resources");
+    commandList["set"] = CommandListArgs("<name> new <class> [<all>[:opt]] [modes] | <name> delete",
+                                            "create or destroy a named resource set");
+    commandList["use"] = CommandListArgs("<set>", "select the set used when a command names no set");
+    commandList["sets"] = CommandListArgs("", "list the resource sets");
+    commandList["log"] = CommandListArgs("[clear]", "show the event log ordered by monotonic timestamp");
 }
 
 Client::~Client()
 {
-    delete resourceSet;
+    foreach(ClientSet *set, sets) {
+        delete set->resourceSet;
+        delete set;
+    }
+    sets.clear();
 }
 
 void Client::showPrompt()
@@ -93,23 +125,82 @@ bool Client::initialize(const CommandLineParser &parser)
         OUTPUT << "client: AutoRelease" << endl;
     }
     showTimings = parser.showTimings();
+    fastExit = parser.shouldExitFast();
 
-    resourceSet = new ResourceSet(parser.resourceApplicationClass(), this,
-                                  parser.shouldAlwaysReply(),
-                                  parser.shouldAutoRelease());
-    if (resourceSet == NULL) {
+    ClientSet *set = createSet(defaultSetName, parser.resourceApplicationClass(),
+                               parser.shouldAlwaysReply(), parser.shouldAutoRelease());
+    if (set == NULL) {
         return false;
     }
+    currentSet = set->name;
 
     allResources.unite(parser.resources());
     optionalResources.unite(parser.optionalResources());
     foreach(ResourcePolicy::ResourceType resource, allResources) {
-        resourceSet->addResource(resource);
+        set->resourceSet->addResource(resource);
         if (optionalResources.contains(resource)) {
-            resourceSet->resource(resource)->setOptional();
+            set->resourceSet->resource(resource)->setOptional();
         }
     }
 
+    if (!connect(&stdInNotifier, SIGNAL(activated(int)), this, SLOT(readLine(int)))) {
+        return false;
+    }
+    if (!connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()),
+                 this, SLOT(doExit()))) {
+        return false;
+    }
+
+    startTimer(set);
+    set->resourceSet->initAndConnect();
+    OUTPUT << "accepting input" << endl;
+    showPrompt();
+    return true;
+}
+
+ClientSet* Client::createSet(const QString &name, const QString &applicationClass,
+                             bool alwaysReply, bool autoRelease)
+{
+    ResourceSet *resourceSet = new ResourceSet(applicationClass, this, alwaysReply, autoRelease);
+    if (resourceSet == NULL) {
+        return NULL;
+    }
+
+    if (!connectSet(resourceSet)) {
+        delete resourceSet;
+        return NULL;
+    }
+
+    ClientSet *set = new ClientSet(name, applicationClass, resourceSet);
+    sets.insert(name, set);
+    logEvent(set, "created (" + applicationClass + ")");
+
+    return set;
+}
+
+void Client::destroySet(const QString &name)
+{
+    ClientSet *set = sets.take(name);
+    if (set == NULL) {
+        return;
+    }
+
+    logEvent(set, "destroyed");
+    delete set->resourceSet;
+    delete set;
+
+    if (currentSet == name) {
+        if (sets.contains(defaultSetName))
+            currentSet = defaultSetName;
+        else if (!sets.isEmpty())
+            currentSet = sets.firstKey();
+        else
+            currentSet = QString();
+    }
+}
+
+bool Client::connectSet(ResourceSet *resourceSet)
+{
     if (!connect(resourceSet, SIGNAL(resourcesGranted(QList<ResourcePolicy::ResourceType>)),
                  this, SLOT(resourceAcquiredHandler(QList<ResourcePolicy::ResourceType>)))) {
         return false;
@@ -133,32 +224,156 @@ bool Client::initialize(const CommandLineParser &parser)
                  this, SLOT(resourceReleasedByManagerHandler()))) {
         return false;
     }
-    if (!connect(&stdInNotifier, SIGNAL(activated(int)), this, SLOT(readLine(int)))) {
+    if (!connect(resourceSet, SIGNAL(updateOK()), this, SLOT(updateOKHandler()))) {
         return false;
     }
     if (!connect(resourceSet , SIGNAL(managerIsUp()), this, SLOT(stopConnectTimerHandler()))) {
         return false;
     }
-    if (!connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()),
-                 this, SLOT(doExit()))) {
-        return false;
+    return true;
+}
+
+ClientSet* Client::senderSet()
+{
+    const QObject *object = sender();
+    foreach(ClientSet *set, sets) {
+        if (set->resourceSet == object)
+            return set;
     }
+    return NULL;
+}
 
-    startTimer();
-    resourceSet->initAndConnect();
-    OUTPUT << "accepting input" << endl;
-    showPrompt();
-    return true;
+ClientSet* Client::selectSet(QTextStream &input)
+{
+    QString name;
+    input >> name;
+
+    if (name.isEmpty() || name.isNull())
+        name = currentSet;
+
+    ClientSet *set = sets.value(name, NULL);
+    if (set == NULL) {
+        OUTPUT << "unknown set '" << name << "'" << endl;
+    }
+    return set;
+}
+
+QString Client::label(const ClientSet *set) const
+{
+    if (set == NULL || set->name == defaultSetName)
+        return QString();
+    return set->name + ": ";
+}
+
+void Client::logEvent(const ClientSet *set, const QString &event)
+{
+    ClientEvent entry;
+    entry.timestamp = monotonic_usec();
+    entry.set = set ? set->name : QString();
+    entry.event = event;
+    eventLog.append(entry);
+}
+
+void Client::showLog()
+{
+    if (eventLog.isEmpty()) {
+        OUTPUT << "event log is empty" << endl;
+        return;
+    }
+
+    QList<ClientEvent> log = eventLog;
+    std::stable_sort(log.begin(), log.end(), eventIsEarlier);
+
+    long long first = log.first().timestamp;
+    long long previous = first;
+    foreach(const ClientEvent &event, log) {
+        OUTPUT << qSetFieldWidth(12) << right
+        << QString::number((event.timestamp - first) / 1000.0, 'f', 3)
+        << qSetFieldWidth(0) << " ms (+"
+        << QString::number((event.timestamp - previous) / 1000.0, 'f', 3) << " ms) "
+        << qSetFieldWidth(10) << left << event.set
+        << qSetFieldWidth(0) << " " << event.event << endl;
+        previous = event.timestamp;
+    }
+}
+
+void Client::handleSetCommand(QTextStream &input)
+{
+    QString name, what;
+    input >> name >> what;
+
+    if (name.isEmpty() || what.isEmpty()) {
+        OUTPUT << "Not enough parameters! See help" << endl;
+        return;
+    }
+
+    if (what == "new") {
+        QString applicationClass, resourceList, modes;
+        bool alwaysReply = false, autoRelease = false;
+        input >> applicationClass >> resourceList >> modes;
+
+        if (applicationClass.isEmpty()) {
+            OUTPUT << "set new requires an application class. See help" << endl;
+            return;
+        }
+        if (sets.contains(name)) {
+            OUTPUT << "set '" << name << "' already exists" << endl;
+            return;
+        }
+
+        QStringList modeList = modes.split(",", QString::SkipEmptyParts);
+        foreach(QString mode, modeList) {
+            if (mode == "AutoRelease") {
+                autoRelease = true;
+            }
+            else if (mode == "AlwaysReply") {
+                alwaysReply = true;
+            }
+            else {
+                OUTPUT << "Ignoring unknown mode '" << mode << "'!" << endl;
+            }
+        }
+
+        ClientSet *set = createSet(name, applicationClass, alwaysReply, autoRelease);
+        if (set == NULL) {
+            qCritical("set %s new failed!", qPrintable(name));
+            return;
+        }
+
+        if (!resourceList.isEmpty())
+            modifyResources(set->resourceSet, resourceList);
+
+        startTimer(set);
+        set->resourceSet->initAndConnect();
+    }
+    else if (what == "delete") {
+        if (!sets.contains(name)) {
+            OUTPUT << "unknown set '" << name << "'" << endl;
+            return;
+        }
+        destroySet(name);
+    }
+    else {
+        OUTPUT << "Unknown set command '" << what << "'!" << endl;
+    }
 }
 
 void Client::doExit()
 {
-    if (resourceSet != NULL)
-        resourceSet->release();
+    if (fastExit) {
+        // The sets are deleted without a word to the manager, closing the
+        // connection releases them all at once.
+        ResourceSet::setFastExit();
+        return;
+    }
+    foreach(ClientSet *set, sets) {
+        if (set->resourceSet != NULL)
+            set->resourceSet->release();
+    }
 }
 
 
-void Client::modifyResources(const QString &resString)
+void Client::modifyResources(ResourceSet *resourceSet, const QString &resString)
 {
     //resString example: [mand_resources:opt_resources] res1,res2,res3:res1,res3
    if ( resString.isEmpty() || resString.isNull()){
@@ -283,14 +498,20 @@ void Client::showResources(const QList<Resource*> &resList)
 
 void Client::stopConnectTimerHandler()
 {
-    stopTimer();
+    ClientSet *set = senderSet();
+    logEvent(set, "manager is up");
+    stopTimer(set);
 }
 
 void Client::resourceAcquiredHandler(const QList<ResourceType>&)
 {
-    stopTimer();
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    stopTimer(set);
 
-    QList<Resource*> list = resourceSet->resources();
+    QList<Resource*> list = set->resourceSet->resources();
     if (!list.count()) {
         qFatal("Resource set is empty, but we received a grant. Possible bug?");
     }
@@ -301,53 +522,91 @@ void Client::resourceAcquiredHandler(const QList<ResourceType>&)
                 grantedResources << resource->type();
             }
         }
-        OUTPUT << "granted:" << grantedResources << endl;
+        logEvent(set, "granted");
+        OUTPUT << label(set) << "granted:" << grantedResources << endl;
     }
     showPrompt();
 }
 
 void Client::resourceDeniedHandler()
 {
-    stopTimer();
-    QList<Resource*> allResources = resourceSet->resources();
-    OUTPUT << "denied:" << allResources << endl;
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    stopTimer(set);
+    logEvent(set, "denied");
+    QList<Resource*> allResources = set->resourceSet->resources();
+    OUTPUT << label(set) << "denied:" << allResources << endl;
     showPrompt();
 }
 
 void Client::resourceLostHandler()
 {
-    stopTimer();
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    stopTimer(set);
+    logEvent(set, "lost");
 
-    QList<Resource*> allResources = resourceSet->resources();
-    outputln << "lost:" << allResources << endl;
+    QList<Resource*> allResources = set->resourceSet->resources();
+    outputln << label(set) << "lost:" << allResources << endl;
     showPrompt();
 }
 
 void Client::resourceReleasedHandler()
 {
-    stopTimer();
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    stopTimer(set);
+    logEvent(set, "released");
 
-    QList<Resource*> allResources = resourceSet->resources();
-    outputln << "released:"<< allResources << endl;
+    QList<Resource*> allResources = set->resourceSet->resources();
+    outputln << label(set) << "released:"<< allResources << endl;
     showPrompt();
 }
 
 void Client::resourceReleasedByManagerHandler()
 {
-    stopTimer();
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    stopTimer(set);
+    logEvent(set, "mgr-released");
 
-    QList<Resource*> allResources = resourceSet->resources();
-    outputln << "mgr-released:"<< allResources << endl;
+    QList<Resource*> allResources = set->resourceSet->resources();
+    outputln << label(set) << "mgr-released:"<< allResources << endl;
     showPrompt();
 }
 
 void Client::resourcesBecameAvailableHandler(const QList<ResourcePolicy::ResourceType> &availableResources)
 {
-    if (pendingAddAudio) {
-        pendingAddAudio = false;
-        stopTimer();
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    if (set->pendingAddAudio) {
+        set->pendingAddAudio = false;
+        stopTimer(set);
     }
-    outputln << "advice:" << availableResources << endl;
+    logEvent(set, "advice");
+    outputln << label(set) << "advice:" << availableResources << endl;
+    showPrompt();
+}
+
+void Client::updateOKHandler()
+{
+    ClientSet *set = senderSet();
+    if (set == NULL)
+        return;
+
+    stopTimer(set);
+    logEvent(set, "updateOK");
+    outputln << label(set) << "updateOK" << endl;
     showPrompt();
 }
 
@@ -383,11 +642,9 @@ void Client::readLine(int)
         }
     }
     else if (command == "show") {
-        if (!resourceSet) {
-            qCritical("%s failed!", qPrintable(command));
-        }
-        else {
-            QList<Resource*> list = resourceSet->resources();
+        ClientSet *set = selectSet(input);
+        if (set != NULL) {
+            QList<Resource*> list = set->resourceSet->resources();
             if (!list.count()) {
                 OUTPUT << "Resource set is empty, use add command to add some."
                 << endl;
@@ -398,17 +655,25 @@ void Client::readLine(int)
         }
     }
     else if (command == "acquire") {
-        startTimer();
-        if (!resourceSet || !resourceSet->acquire()) {
-            stopTimer();
-            qCritical("%s failed!", qPrintable(command));
+        ClientSet *set = selectSet(input);
+        if (set != NULL) {
+            startTimer(set);
+            logEvent(set, "acquire");
+            if (!set->resourceSet->acquire()) {
+                stopTimer(set);
+                qCritical("%s failed!", qPrintable(command));
+            }
         }
     }
     else if (command == "release") {
-        startTimer();
-        if (!resourceSet || !resourceSet->release()) {
-            stopTimer();
-            qCritical("%s failed!", qPrintable(command));
+        ClientSet *set = selectSet(input);
+        if (set != NULL) {
+            startTimer(set);
+            logEvent(set, "release");
+            if (!set->resourceSet->release()) {
+                stopTimer(set);
+                qCritical("%s failed!", qPrintable(command));
+            }
         }
     }
     else if (command == "update") {
@@ -416,32 +681,66 @@ void Client::readLine(int)
         QString resourceList;
         input >> resourceList;
 
-        if (!resourceSet) {
-            qCritical("%s failed!", qPrintable(command));
-        }
-        else if (resourceList.isEmpty() || resourceList.isNull()) {
+        if (resourceList.isEmpty() || resourceList.isNull()) {
              qCritical("%s failed! List of desired resources is missing. Use help.",
                        qPrintable(command));
         }
         else {
-            startTimer();
-            modifyResources(resourceList);
-
-            if (!resourceSet->update())
-                qCritical("%s failed!", qPrintable(command));
+            ClientSet *set = selectSet(input);
+            if (set != NULL) {
+                startTimer(set);
+                logEvent(set, "update");
+                modifyResources(set->resourceSet, resourceList);
+
+                if (!set->resourceSet->update())
+                    qCritical("%s failed!", qPrintable(command));
+            }
         }
 
     }
+    else if (command == "set") {
+        handleSetCommand(input);
+    }
+    else if (command == "use") {
+        QString name;
+        input >> name;
+        if (!sets.contains(name)) {
+            OUTPUT << "unknown set '" << name << "'" << endl;
+        }
+        else {
+            currentSet = name;
+        }
+    }
+    else if (command == "sets") {
+        foreach(ClientSet *set, sets) {
+            OUTPUT << (set->name == currentSet ? "* " : "  ")
+            << qSetFieldWidth(10) << left << set->name
+            << qSetFieldWidth(0) << " " << set->applicationClass
+            << set->resourceSet->resources() << endl;
+        }
+    }
+    else if (command == "log") {
+        QString what;
+        input >> what;
+        if (what == "clear")
+            eventLog.clear();
+        else
+            showLog();
+    }
     else if (command == "audio") {
         QString what, group, tagName, tagValue;
         quint32 pid = 0;
         input >> what;
 
+        ClientSet *set = sets.value(currentSet, NULL);
         if (what.isEmpty() || what.isNull()) {
             OUTPUT << "Not enough parameters! See help" << endl;
         }
+        else if (set == NULL) {
+            OUTPUT << "No resource set selected!" << endl;
+        }
         else {
-            Resource *resource = resourceSet->resource(AudioPlaybackType);
+            Resource *resource = set->resourceSet->resource(AudioPlaybackType);
             AudioResource *audioResource = static_cast<AudioResource*>(resource);
             qDebug("resource = %p audioResource = %p", resource, audioResource);
             if (audioResource == NULL) {
@@ -484,9 +783,13 @@ void Client::readLine(int)
         quint32 pid = 0;
         input >> group >> pid >> tagName >> tagValue;
 
+        ClientSet *set = sets.value(currentSet, NULL);
         if (group.isEmpty() || (pid == 0) || tagName.isEmpty() || tagValue.isEmpty()) {
             OUTPUT << "Invalid parameters! See help!" << endl;
         }
+        else if (set == NULL) {
+            OUTPUT << "No resource set selected!" << endl;
+        }
         else {
             AudioResource *audioResource = new AudioResource(group);
             if (audioResource == NULL) {
@@ -495,9 +798,9 @@ void Client::readLine(int)
             else {
                 audioResource->setProcessID(pid);
                 audioResource->setStreamTag(tagName, tagValue);
-                pendingAddAudio = true;
-                startTimer();
-                resourceSet->addResourceObject(audioResource);
+                set->pendingAddAudio = true;
+                startTimer(set);
+                set->resourceSet->addResourceObject(audioResource);
             }
         }
     }
@@ -506,11 +809,15 @@ void Client::readLine(int)
         quint32 pid = 0;
         input >> what;
 
+        ClientSet *set = sets.value(currentSet, NULL);
         if (what.isEmpty() || what.isNull()) {
             OUTPUT << "Not enough parameters! See help" << endl;
         }
+        else if (set == NULL) {
+            OUTPUT << "No resource set selected!" << endl;
+        }
         else {
-            Resource *resource = resourceSet->resource(VideoPlaybackType);
+            Resource *resource = set->resourceSet->resource(VideoPlaybackType);
             VideoResource *videoResource = static_cast<VideoResource*>(resource);
             qDebug("resource = %p videoResource = %p", resource, videoResource);
 
@@ -538,9 +845,13 @@ void Client::readLine(int)
         quint32 pid = 0;
         input >> pid ;
 
+        ClientSet *set = sets.value(currentSet, NULL);
         if (  pid == 0  ) {
             OUTPUT << "Invalid process ID! See help!" << endl;
         }
+        else if (set == NULL) {
+            OUTPUT << "No resource set selected!" << endl;
+        }
         else {
             VideoResource *videoResource = new VideoResource();
 
@@ -549,15 +860,25 @@ void Client::readLine(int)
             }
             else {
                 videoResource->setProcessID(pid);
-                pendingAddAudio = true;
-                startTimer();
-                resourceSet->addResourceObject(videoResource);
+                set->pendingAddAudio = true;
+                startTimer(set);
+                set->resourceSet->addResourceObject(videoResource);
             }
         }
     }
     else if (command == "free") {
-        delete resourceSet;
-        resourceSet = new ResourceSet(applicationClass);
+        ClientSet *set = selectSet(input);
+        if (set != NULL) {
+            QString name = set->name;
+            QString applicationClass = set->applicationClass;
+            bool alwaysReply = set->resourceSet->alwaysGetReply();
+            bool autoRelease = set->resourceSet->willAutoRelease();
+            bool wasCurrent = (name == currentSet);
+
+            destroySet(name);
+            if (createSet(name, applicationClass, alwaysReply, autoRelease) && wasCurrent)
+                currentSet = name;
+        }
     }
     else {
         OUTPUT << "unknown command '" << command << "'" << endl;
@@ -588,19 +909,19 @@ QTextStream & operator<< (QTextStream &output,
     return output;
 }
 
-void Client::startTimer()
+void Client::startTimer(ClientSet *set)
 {
-    if (showTimings) {
-        start_timer();
+    if (showTimings && set != NULL) {
+        start_timer_r(&set->timer);
     }
 }
 
-void Client::stopTimer()
+void Client::stopTimer(ClientSet *set)
 {
-    if (showTimings) {
-        long int ms = stop_timer();
+    if (showTimings && set != NULL) {
+        long int ms = stop_timer_r(&set->timer);
         if (ms > 0) {
-            outputln << "Operation took " << ms << " ms" << endl;
+            outputln << label(set) << "Operation took " << ms << " ms" << endl;
         }
     }
 }
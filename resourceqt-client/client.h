@@ -43,6 +43,34 @@ public:
     QString help;
 };
 
+/**
+ * A named resource set managed by the client, with its own request timer.
+ */
+class ClientSet
+{
+public:
+    ClientSet();
+    ClientSet(const QString &setName, const QString &setClass,
+              ResourcePolicy::ResourceSet *set);
+
+    QString name;
+    QString applicationClass;
+    ResourcePolicy::ResourceSet *resourceSet;
+    bool pendingAddAudio;
+    struct timespec timer;
+};
+
+/**
+ * One entry of the client event log, timestamped with CLOCK_MONOTONIC.
+ */
+class ClientEvent
+{
+public:
+    long long timestamp;
+    QString set;
+    QString event;
+};
+
 class Client : public QObject
 {
     Q_OBJECT
@@ -61,6 +89,7 @@ private slots:
     void resourceReleasedHandler();
     void resourceReleasedByManagerHandler();
     void resourcesBecameAvailableHandler(const QList<ResourcePolicy::ResourceType> &availableResources);
+    void updateOKHandler();
     void readLine(int);
     void doExit();
     void stopConnectTimerHandler();
@@ -68,24 +97,37 @@ private slots:
 private:
     QTextStream standardInput;
     QSocketNotifier stdInNotifier;
-    bool pendingAddAudio;
-    QString applicationClass;
-    ResourcePolicy::ResourceSet *resourceSet;
+    QMap<QString, ClientSet*> sets;
+    QString currentSet;
     QTextStream output;
     QString prefix;
     bool showTimings;
+    bool fastExit;
+    QList<ClientEvent> eventLog;
 
+    static const char *defaultSetName;
     static QMap<QString, CommandListArgs> commandList;
 
     ResourcePolicy::Resource* allocateResource(ResourcePolicy::ResourceType resource, bool optional);
     ResourcePolicy::ResourceType getResourceType(uint32_t resource);
 
+    ClientSet* createSet(const QString &name, const QString &applicationClass,
+                         bool alwaysReply, bool autoRelease);
+    void destroySet(const QString &name);
+    bool connectSet(ResourcePolicy::ResourceSet *set);
+    ClientSet* senderSet();
+    ClientSet* selectSet(QTextStream &input);
+    QString label(const ClientSet *set) const;
+    void logEvent(const ClientSet *set, const QString &event);
+    void showLog();
+    void handleSetCommand(QTextStream &input);
+
     void showPrompt();
     void showResources(const QList<ResourcePolicy::ResourceType> &resList);
     void showResources(const QList<ResourcePolicy::Resource*> &resList);
-    void modifyResources(const QString &resString);
-    inline void startTimer();
-    inline void stopTimer();
+    void modifyResources(ResourcePolicy::ResourceSet *resourceSet, const QString &resString);
+    inline void startTimer(ClientSet *set);
+    inline void stopTimer(ClientSet *set);
 };
 
 QTextStream & operator<< (QTextStream &output,
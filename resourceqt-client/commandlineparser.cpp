@@ -29,7 +29,7 @@ QHash<QString, ResourcePolicy::ResourceType> CommandLineParser::resourceValues;
 CommandLineParser::CommandLineParser():
         allResources(), optResources(), autoRelease(false), alwaysReply(false),
         verbose(false), allowUnkownResourceClass(false), output(stdout), prefix(""),
-        timings(false)
+        timings(false), fastExit(false)
 {
     resourceValues["AudioPlayback"] = ResourcePolicy::AudioPlaybackType;
     resourceValues["VideoPlayback"] = ResourcePolicy::VideoPlaybackType;
@@ -82,6 +82,9 @@ bool CommandLineParser::parseArguments()
             case 'u':
                 allowUnkownResourceClass = true;
                 break;
+            case 'x':
+                fastExit = true;
+                break;
             case 'v':
                 verbose = true;
                 break;
@@ -200,13 +203,14 @@ bool CommandLineParser::parseModeValues(const QString &modeListStr)
 void CommandLineParser::usage()
 {
     output << "usage: resourceqt-client [-h] [-f mode-values]" <<
-    "[-o optional-resources] [-i] [-v] [-p prefix] " <<
+    "[-o optional-resources] [-i] [-v] [-x] [-p prefix] " <<
     "class all-resources" << endl;
     output << "\toptions:" << endl;
     output << "\t -h\tprint this help message and exit" << endl;
     output << "\t -i\tshow timings of requests" << endl;
     output << "\t -v\tshow debug of libresourceqt" << endl;
     output << "\t -p\tPrefix all output with the given prefix" << endl;
+    output << "\t -x\texit without releasing or unregistering each set" << endl;
     output << "\t -f\tmode values. See 'modes' below for the "
     "\n\t\tsyntax of <mode-values>" << endl;
     output << "\t -o\toptional resources. See 'resources' below for the "
@@ -271,3 +275,8 @@ bool CommandLineParser::showTimings() const
 {
     return timings;
 }
+
+bool CommandLineParser::shouldExitFast() const
+{
+    return fastExit;
+}
@@ -48,6 +48,7 @@ public:
     bool shouldBeVerbose() const;
     QString getPrefix() const;
     bool showTimings() const;
+    bool shouldExitFast() const;
 
 private:
     QSet<ResourcePolicy::ResourceType> allResources;
@@ -61,6 +62,7 @@ private:
     QTextStream output;
     QString prefix;
     bool timings;
+    bool fastExit;
 
     bool parseClassString(const QString &str);
     void parsePrefix(const QString &str);
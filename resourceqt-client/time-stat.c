@@ -23,9 +23,19 @@ USA.
 static struct timespec start_time;
 
 int start_timer(void)
+{
+    return start_timer_r(&start_time);
+}
+
+long int stop_timer(void)
+{
+    return stop_timer_r(&start_time);
+}
+
+int start_timer_r(struct timespec *start)
 {
     int r;
-    r = clock_gettime(CLOCK_REALTIME, &start_time);
+    r = clock_gettime(CLOCK_MONOTONIC, start);
 
     if (r == 0)
         return 1;
@@ -33,32 +43,44 @@ int start_timer(void)
         return 0;
 }
 
-long int stop_timer(void)
+long int stop_timer_r(struct timespec *start)
 {
     struct timespec end_time;
     int r;
     long int milliseconds = 0L;
 
-    r = clock_gettime(CLOCK_REALTIME, &end_time);
+    if (start->tv_sec == 0 && start->tv_nsec == 0)
+        return 0L;
+
+    r = clock_gettime(CLOCK_MONOTONIC, &end_time);
 
     if (r == 0) {
-    	struct timespec temp;
-	    if (end_time.tv_nsec < start_time.tv_nsec) {
-		    temp.tv_sec  = end_time.tv_sec - start_time.tv_sec - 1;
-		    temp.tv_nsec = 1000000000 + end_time.tv_nsec - start_time.tv_nsec;
-    	} else {
-    		temp.tv_sec  = end_time.tv_sec  - start_time.tv_sec;
-    		temp.tv_nsec = end_time.tv_nsec - start_time.tv_nsec;
-    	}
+        struct timespec temp;
+        if (end_time.tv_nsec < start->tv_nsec) {
+            temp.tv_sec  = end_time.tv_sec - start->tv_sec - 1;
+            temp.tv_nsec = 1000000000 + end_time.tv_nsec - start->tv_nsec;
+        } else {
+            temp.tv_sec  = end_time.tv_sec  - start->tv_sec;
+            temp.tv_nsec = end_time.tv_nsec - start->tv_nsec;
+        }
 
         milliseconds = (1000 * temp.tv_sec) + (temp.tv_nsec / 1000000);
         if (temp.tv_nsec % 1000000 > 500000) {
             ++milliseconds;
         }
     }
-    start_time.tv_sec = 0;
-    start_time.tv_nsec = 0;
+    start->tv_sec = 0;
+    start->tv_nsec = 0;
 
     return milliseconds;
 }
 
+long long monotonic_usec(void)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+        return 0LL;
+
+    return (long long) now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
@@ -29,6 +29,14 @@ extern "C" {
     int start_timer(void);
 
     long int stop_timer(void);
+
+    /* Re-entrant variants, one timer per caller supplied timespec. */
+    int start_timer_r(struct timespec *start);
+
+    long int stop_timer_r(struct timespec *start);
+
+    /* Current CLOCK_MONOTONIC time in microseconds. */
+    long long monotonic_usec(void);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,283 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <QElapsedTimer>
+#include <QTimer>
+#include <poll.h>
+#include <dbusconnectioneventloop.h>
+#include "benchmark-dbus-eventloop.h"
+
+#define BENCHMARK_INTERFACE "org.maemo.libresourceqt.Benchmark"
+#define BENCHMARK_MEMBER    "Ping"
+#define BENCHMARK_PATH      "/org/maemo/libresourceqt/Benchmark"
+
+// Messages sent per benchmark iteration.
+static const int MessagesPerRound = 2000;
+
+// Pending calls started per timeout churn iteration.
+static const int CallsPerRound = 500;
+
+Q_DECLARE_METATYPE(DBUSConnectionEventLoop::Backend)
+
+BenchmarkDBusEventLoop::BenchmarkDBusEventLoop()
+    : sender(NULL), replied(0), received(0), expected(0)
+{
+}
+
+BenchmarkDBusEventLoop::~BenchmarkDBusEventLoop()
+{
+    closeConnections();
+}
+
+DBusHandlerResult BenchmarkDBusEventLoop::filter(DBusConnection *, DBusMessage *msg, void *data)
+{
+    BenchmarkDBusEventLoop *self = reinterpret_cast<BenchmarkDBusEventLoop *>(data);
+
+    if (!dbus_message_is_method_call(msg, BENCHMARK_INTERFACE, BENCHMARK_MEMBER))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    if (++self->received == self->expected)
+        self->loop.quit();
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+void BenchmarkDBusEventLoop::pendingCallNotify(DBusPendingCall *, void *data)
+{
+    BenchmarkDBusEventLoop *self = reinterpret_cast<BenchmarkDBusEventLoop *>(data);
+
+    if (++self->replied == self->expected)
+        self->loop.quit();
+}
+
+void BenchmarkDBusEventLoop::printStatistics()
+{
+    DBUSConnectionEventLoop::Statistics stats = DBUSConnectionEventLoop::statistics();
+
+    qWarning("read events %llu, write events %llu, wakeups %llu",
+             stats.readEvents, stats.writeEvents, stats.wakeups);
+    qWarning("dispatch passes %llu, messages %llu, longest pass %lld us",
+             stats.dispatchPasses, stats.messagesDispatched, stats.longestDispatchSlice);
+    qWarning("dispatch time <10us %llu, <100us %llu, <1ms %llu, <10ms %llu, <100ms %llu, longer %llu",
+             stats.dispatchTime[0], stats.dispatchTime[1], stats.dispatchTime[2],
+             stats.dispatchTime[3], stats.dispatchTime[4], stats.dispatchTime[5]);
+}
+
+// Drive the loop the way a host with its own poll loop would.
+void BenchmarkDBusEventLoop::runExternalLoop(int timeout)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    while (received < expected && elapsed.elapsed() < timeout) {
+        struct pollfd pfd;
+        pfd.fd = DBUSConnectionEventLoop::pollDescriptor();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int wait = DBUSConnectionEventLoop::nextTimeout();
+        if (wait < 0 || wait > 100)
+            wait = 100;
+
+        poll(&pfd, 1, wait);
+        DBUSConnectionEventLoop::processEvents();
+    }
+}
+
+bool BenchmarkDBusEventLoop::openConnections(int count)
+{
+    sender = dbus_bus_get_private(DBUS_BUS_SESSION, NULL);
+    if (sender == NULL)
+        return false;
+
+    dbus_connection_set_exit_on_disconnect(sender, FALSE);
+    DBUSConnectionEventLoop::addConnection(sender);
+
+    for (int i = 0; i < count; ++i) {
+        DBusConnection *receiver = dbus_bus_get_private(DBUS_BUS_SESSION, NULL);
+        if (receiver == NULL)
+            return false;
+
+        dbus_connection_set_exit_on_disconnect(receiver, FALSE);
+        dbus_connection_add_filter(receiver, filter, this, NULL);
+        DBUSConnectionEventLoop::addConnection(receiver);
+        receivers.append(receiver);
+    }
+
+    return true;
+}
+
+void BenchmarkDBusEventLoop::closeConnections()
+{
+    foreach (DBusConnection *receiver, receivers) {
+        DBUSConnectionEventLoop::removeConnection(receiver);
+        dbus_connection_remove_filter(receiver, filter, this);
+        dbus_connection_close(receiver);
+        dbus_connection_unref(receiver);
+    }
+    receivers.clear();
+
+    if (sender != NULL) {
+        DBUSConnectionEventLoop::removeConnection(sender);
+        dbus_connection_close(sender);
+        dbus_connection_unref(sender);
+        sender = NULL;
+    }
+}
+
+void BenchmarkDBusEventLoop::benchmarkThroughput_data()
+{
+    QTest::addColumn<DBUSConnectionEventLoop::Backend>("backend");
+    QTest::addColumn<int>("connections");
+    QTest::addColumn<int>("budget");
+
+    QTest::newRow("socketnotifier, 1 receiver") << DBUSConnectionEventLoop::SocketNotifierBackend << 1 << 0;
+    QTest::newRow("epoll, 1 receiver") << DBUSConnectionEventLoop::EpollBackend << 1 << 0;
+    QTest::newRow("socketnotifier, 16 receivers") << DBUSConnectionEventLoop::SocketNotifierBackend << 16 << 0;
+    QTest::newRow("epoll, 16 receivers") << DBUSConnectionEventLoop::EpollBackend << 16 << 0;
+    QTest::newRow("socketnotifier, 16 receivers, budget 32") << DBUSConnectionEventLoop::SocketNotifierBackend << 16 << 32;
+    QTest::newRow("epoll, 16 receivers, budget 32") << DBUSConnectionEventLoop::EpollBackend << 16 << 32;
+    QTest::newRow("external poll, 1 receiver") << DBUSConnectionEventLoop::ExternalBackend << 1 << 0;
+    QTest::newRow("external poll, 16 receivers") << DBUSConnectionEventLoop::ExternalBackend << 16 << 0;
+}
+
+void BenchmarkDBusEventLoop::benchmarkThroughput()
+{
+    QFETCH(DBUSConnectionEventLoop::Backend, backend);
+    QFETCH(int, connections);
+    QFETCH(int, budget);
+
+    if (!DBUSConnectionEventLoop::setBackend(backend))
+        QSKIP("Backend not available");
+
+    DBUSConnectionEventLoop::setDispatchBudget(budget);
+
+    if (!openConnections(connections)) {
+        closeConnections();
+        QSKIP("No session bus available");
+    }
+
+    QList<QByteArray> names;
+    foreach (DBusConnection *receiver, receivers)
+        names.append(dbus_bus_get_unique_name(receiver));
+
+    QTimer watchdog;
+    watchdog.setSingleShot(true);
+    loop.connect(&watchdog, SIGNAL(timeout()), SLOT(quit()));
+
+    DBUSConnectionEventLoop::resetStatistics();
+
+    QBENCHMARK {
+        received = 0;
+        expected = MessagesPerRound;
+
+        for (int i = 0; i < MessagesPerRound; ++i) {
+            DBusMessage *msg = dbus_message_new_method_call(names.at(i % names.size()).constData(),
+                                                            BENCHMARK_PATH,
+                                                            BENCHMARK_INTERFACE,
+                                                            BENCHMARK_MEMBER);
+            dbus_message_set_no_reply(msg, TRUE);
+            dbus_connection_send(sender, msg, NULL);
+            dbus_message_unref(msg);
+        }
+
+        if (backend == DBUSConnectionEventLoop::ExternalBackend)
+            runExternalLoop(10000);
+        else {
+            watchdog.start(10000);
+            loop.exec();
+            watchdog.stop();
+        }
+
+        QCOMPARE(received, expected);
+    }
+
+    printStatistics();
+
+    closeConnections();
+    DBUSConnectionEventLoop::setBackend(DBUSConnectionEventLoop::SocketNotifierBackend);
+    DBUSConnectionEventLoop::setDispatchBudget(0);
+}
+
+void BenchmarkDBusEventLoop::benchmarkTimeoutChurn_data()
+{
+    QTest::addColumn<bool>("cancel");
+
+    QTest::newRow("cancelled") << true;
+    QTest::newRow("replied") << false;
+}
+
+void BenchmarkDBusEventLoop::benchmarkTimeoutChurn()
+{
+    QFETCH(bool, cancel);
+
+    if (!openConnections(0)) {
+        closeConnections();
+        QSKIP("No session bus available");
+    }
+
+    QList<DBusPendingCall *> calls;
+    calls.reserve(CallsPerRound);
+
+    QTimer watchdog;
+    watchdog.setSingleShot(true);
+    loop.connect(&watchdog, SIGNAL(timeout()), SLOT(quit()));
+
+    QBENCHMARK {
+        replied = 0;
+        expected = CallsPerRound;
+
+        for (int i = 0; i < CallsPerRound; ++i) {
+            DBusMessage *msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS,
+                                                            DBUS_PATH_DBUS,
+                                                            "org.freedesktop.DBus.Peer",
+                                                            "Ping");
+            DBusPendingCall *pending = NULL;
+
+            // Each pending call owns a timeout registered with the loop.
+            if (dbus_connection_send_with_reply(sender, msg, &pending, 25000) && pending) {
+                dbus_pending_call_set_notify(pending, pendingCallNotify, this, NULL);
+                calls.append(pending);
+            }
+            dbus_message_unref(msg);
+        }
+
+        if (cancel) {
+            foreach (DBusPendingCall *pending, calls)
+                dbus_pending_call_cancel(pending);
+        }
+        else {
+            watchdog.start(10000);
+            loop.exec();
+            watchdog.stop();
+
+            QCOMPARE(replied, expected);
+        }
+
+        foreach (DBusPendingCall *pending, calls)
+            dbus_pending_call_unref(pending);
+        calls.clear();
+    }
+
+    closeConnections();
+}
+
+QTEST_MAIN(BenchmarkDBusEventLoop)
@@ -0,0 +1,69 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef BENCHMARK_DBUS_EVENTLOOP_H
+#define BENCHMARK_DBUS_EVENTLOOP_H
+
+#include <QObject>
+#include <QList>
+#include <QEventLoop>
+#include <QtTest/QTest>
+
+#include <dbus/dbus.h>
+
+/**
+ * Message throughput of libdbus-qeventloop with each readiness backend.
+ * One private session bus connection sends a burst of messages that is
+ * spread over a number of receiving connections, all driven by the
+ * DBUSConnectionEventLoop. Timeout churn is measured with pending method
+ * calls, each of which adds, toggles and removes a libdbus timeout.
+ */
+class BenchmarkDBusEventLoop: public QObject
+{
+    Q_OBJECT
+public:
+    BenchmarkDBusEventLoop();
+    ~BenchmarkDBusEventLoop();
+
+private:
+    bool openConnections(int count);
+    void closeConnections();
+    void printStatistics();
+    void runExternalLoop(int timeout);
+
+    static DBusHandlerResult filter(DBusConnection *conn, DBusMessage *msg, void *data);
+    static void pendingCallNotify(DBusPendingCall *pending, void *data);
+
+    DBusConnection *sender;
+    QList<DBusConnection *> receivers;
+    QEventLoop loop;
+    int replied;
+    int received;
+    int expected;
+
+private slots:
+    void benchmarkThroughput_data();
+    void benchmarkThroughput();
+    void benchmarkTimeoutChurn_data();
+    void benchmarkTimeoutChurn();
+};
+
+#endif
@@ -23,7 +23,13 @@ USA.
 #include <QList>
 #include <QEventLoop>
 #include <QTimer>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QProcess>
+#include <policy/resource-set-pool.h>
 #include "benchmark-resource-set.h"
+#include "syscall-counter.h"
 
 using namespace ResourcePolicy;
 
@@ -156,4 +162,355 @@ void BenchmarkResourceSet::benchmarkRelease()
     }
 }
 
+void BenchmarkResourceSet::benchmarkColdStart()
+{
+    // From a set that does not exist yet to the first grant: the REGISTER,
+    // the audio properties and the acquire all go out back to back.
+    QElapsedTimer timer;
+    timer.start();
+
+    ResourceSet resourceSet("player");
+    AudioResource *audio = new AudioResource("player");
+    audio->setProcessID(QCoreApplication::applicationPid());
+    audio->setStreamTag("media.name", "benchmark");
+    resourceSet.addResourceObject(audio);
+    resourceSet.acquire();
+    waitForSignal(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+
+    QTest::setBenchmarkResult(timer.nsecsElapsed() / 1000000.0, QTest::WalltimeMilliseconds);
+
+    resourceSet.release();
+    waitForSignal(&resourceSet, SIGNAL(resourcesReleased()));
+}
+
+void BenchmarkResourceSet::benchmarkToggle_data()
+{
+    QTest::addColumn<bool>("pipelined");
+
+    QTest::newRow("serialized") << false;
+    QTest::newRow("pipelined") << true;
+}
+
+void BenchmarkResourceSet::benchmarkToggle()
+{
+    QFETCH(bool, pipelined);
+
+    // Pause/play: a release immediately followed by an acquire.
+    ResourceSet resourceSet("player");
+    resourceSet.addResource(AudioPlaybackType);
+    QVERIFY(resourceSet.setPipelinedRequests(pipelined));
+    resourceSet.acquire();
+    waitForSignal(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+
+    QBENCHMARK {
+        resourceSet.release();
+        resourceSet.acquire();
+        waitForSignal(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+    }
+
+    resourceSet.release();
+    waitForSignal(&resourceSet, SIGNAL(resourcesReleased()));
+}
+
+void BenchmarkResourceSet::benchmarkHandover_data()
+{
+    QTest::addColumn<bool>("busy");
+
+    QTest::newRow("idle") << false;
+    QTest::newRow("busy") << true;
+}
+
+void BenchmarkResourceSet::benchmarkHandover()
+{
+    QFETCH(bool, busy);
+
+    // The player holds the audio while a lower priority set waits for it;
+    // measured is the time from the player's release() to the grant of the
+    // waiting set. When busy, the player still has an update outstanding
+    // and an acquire queued behind it, which the release has to overtake.
+    ResourceSet player("player");
+    player.addResource(AudioPlaybackType);
+    player.acquire();
+    waitForSignal(&player, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+
+    ResourceSet waiting("background");
+    waiting.addResource(AudioPlaybackType);
+    waiting.acquire();
+    waitForSignal(&waiting, SIGNAL(managerIsUp()));
+
+    QElapsedTimer timer;
+    timer.start();
+    if (busy) {
+        player.update();
+        player.acquire();
+    }
+    player.release();
+    waitForSignal(&waiting, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+
+    QTest::setBenchmarkResult(timer.nsecsElapsed() / 1000000.0, QTest::WalltimeMilliseconds);
+
+    waiting.release();
+    waitForSignal(&waiting, SIGNAL(resourcesReleased()));
+}
+
+StressThread::StressThread(ResourceSet *set, int iterations)
+    : set(set), iterations(iterations)
+{
+}
+
+void StressThread::run()
+{
+    for (int i = 0; i < iterations; i++) {
+        ResourceSet scratch("player");
+        createdIds << scratch.id();
+        set->acquire();
+        set->release();
+    }
+}
+
+void BenchmarkResourceSet::benchmarkThreadedStress_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1") << 1;
+    QTest::newRow("2") << 2;
+    QTest::newRow("4") << 4;
+    QTest::newRow("8") << 8;
+}
+
+void BenchmarkResourceSet::benchmarkThreadedStress()
+{
+    QFETCH(int, threads);
+    const int iterations = 100;
+
+    ResourceSet resourceSet("player", NULL, true, false);
+    QVERIFY(resourceSet.setThreadSafe());
+    resourceSet.addResource(AudioPlaybackType);
+    resourceSet.initAndConnect();
+    waitForSignal(&resourceSet, SIGNAL(managerIsUp()));
+
+    QSignalSpy granted(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+    QSignalSpy released(&resourceSet, SIGNAL(resourcesReleased()));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<StressThread *> workers;
+    for (int i = 0; i < threads; i++) {
+        workers << new StressThread(&resourceSet, iterations);
+        workers.last()->start();
+    }
+    foreach (StressThread *worker, workers)
+        QVERIFY(worker->wait(60000));
+
+    // The requests are carried out by this thread; run until the replies
+    // stop coming, the last request of every worker was a release.
+    qint64 lastReply = timer.elapsed();
+    int replies = -1;
+    while (replies != granted.count() + released.count()) {
+        replies = granted.count() + released.count();
+        lastReply = timer.elapsed();
+        waitForSignal(&resourceSet, SIGNAL(resourcesReleased()), 500);
+    }
+
+    QSet<quint32> ids;
+    foreach (StressThread *worker, workers) {
+        foreach (quint32 id, worker->createdIds)
+            ids << id;
+    }
+    qDeleteAll(workers);
+
+    QCOMPARE(ids.size(), threads * iterations);
+    QVERIFY(!resourceSet.hasResourcesGranted());
+    QVERIFY(released.count() > 0);
+
+    qWarning("%d threads: %d requests, %d replies in %lld ms", threads,
+             2 * threads * iterations, replies, lastReply);
+    QTest::setBenchmarkResult(lastReply, QTest::WalltimeMilliseconds);
+}
+
+void BenchmarkResourceSet::benchmarkReconnect_data()
+{
+    QTest::addColumn<int>("sets");
+
+    QTest::newRow("1") << 1;
+    QTest::newRow("10") << 10;
+    QTest::newRow("100") << 100;
+}
+
+void BenchmarkResourceSet::benchmarkReconnect()
+{
+    QFETCH(int, sets);
+
+    // Restarting the policy manager needs privileges, the command doing it
+    // is given in the environment.
+    QByteArray restartCommand = qgetenv("BENCHMARK_RESTART_MANAGER");
+    if (restartCommand.isEmpty())
+        QSKIP("set BENCHMARK_RESTART_MANAGER to the command restarting the policy manager");
+
+    // Half of the sets hold their resources, the other half only have
+    // their properties registered, which have to be replayed as well.
+    QList<ResourceSet *> resourceSets;
+    for (int i = 0; i < sets; i++) {
+        ResourceSet *resourceSet = new ResourceSet("background");
+        AudioResource *audio = new AudioResource("background");
+        audio->setProcessID(QCoreApplication::applicationPid());
+        audio->setStreamTag("media.name", "benchmark");
+        resourceSet->addResourceObject(audio);
+        if (i % 2 == 0) {
+            resourceSet->acquire();
+            waitForSignal(resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+        } else {
+            resourceSet->initAndConnect();
+            waitForSignal(resourceSet, SIGNAL(managerIsUp()));
+        }
+        resourceSets << resourceSet;
+    }
+
+    QList<QSignalSpy *> spies;
+    foreach (ResourceSet *resourceSet, resourceSets)
+        spies << new QSignalSpy(resourceSet, SIGNAL(managerIsUp()));
+
+    QVERIFY(QProcess::execute(QString::fromLocal8Bit(restartCommand)) == 0);
+
+    // Recovered once every set is registered again.
+    QElapsedTimer timer;
+    timer.start();
+    int recovered = 0;
+    while (recovered < sets && timer.elapsed() < 30000) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+        recovered = 0;
+        foreach (QSignalSpy *spy, spies)
+            recovered += spy->count() > 0 ? 1 : 0;
+    }
+    qint64 elapsed = timer.elapsed();
+
+    qDeleteAll(spies);
+    QCOMPARE(recovered, sets);
+    QTest::setBenchmarkResult(elapsed, QTest::WalltimeMilliseconds);
+
+    qDeleteAll(resourceSets);
+}
+
+void BenchmarkResourceSet::benchmarkFirstAcquire_data()
+{
+    QTest::addColumn<bool>("pooled");
+
+    QTest::newRow("fresh") << false;
+    QTest::newRow("pooled") << true;
+}
+
+void BenchmarkResourceSet::benchmarkFirstAcquire()
+{
+    QFETCH(bool, pooled);
+
+    QList<ResourceType> ringtone;
+    ringtone << AudioPlaybackType;
+
+    ResourceSetPool pool;
+    if (pooled) {
+        pool.reserve("ringtone", ringtone);
+        QTest::qWait(500);
+    }
+
+    // From needing a set to holding its resources.
+    QElapsedTimer timer;
+    timer.start();
+    ResourceSet *resourceSet = pool.take("ringtone", ringtone);
+    resourceSet->acquire();
+    waitForSignal(resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+    QTest::setBenchmarkResult(timer.nsecsElapsed() / 1000000.0, QTest::WalltimeMilliseconds);
+
+    resourceSet->release();
+    waitForSignal(resourceSet, SIGNAL(resourcesReleased()));
+    delete resourceSet;
+}
+
+void BenchmarkResourceSet::benchmarkCorkedSyscalls_data()
+{
+    QTest::addColumn<bool>("corked");
+
+    QTest::newRow("uncorked") << false;
+    QTest::newRow("corked") << true;
+}
+
+void BenchmarkResourceSet::benchmarkCorkedSyscalls()
+{
+    QFETCH(bool, corked);
+
+    ResourceSet resourceSet("player");
+    AudioResource *audio = new AudioResource("player");
+    resourceSet.addResourceObject(audio);
+    resourceSet.addResource(VideoPlaybackType);
+    resourceSet.initAndConnect();
+    waitForSignal(&resourceSet, SIGNAL(managerIsUp()));
+
+    // A typical playback start: the audio stream is described, the set is
+    // updated and acquired, all from one event loop iteration.
+    SyscallCounter::start();
+    if (corked)
+        resourceSet.cork();
+    audio->setProcessID(QCoreApplication::applicationPid());
+    audio->setStreamTag("media.name", "benchmark");
+    resourceSet.update();
+    resourceSet.acquire();
+    if (corked)
+        resourceSet.uncork();
+    waitForSignal(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+    QTest::setBenchmarkResult(SyscallCounter::stop(), QTest::Events);
+
+    resourceSet.release();
+    waitForSignal(&resourceSet, SIGNAL(resourcesReleased()));
+}
+
+void BenchmarkResourceSet::benchmarkExit_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("fast");
+
+    QTest::newRow("1 set") << 1 << false;
+    QTest::newRow("1 set, fast exit") << 1 << true;
+    QTest::newRow("100 sets") << 100 << false;
+    QTest::newRow("100 sets, fast exit") << 100 << true;
+    QTest::newRow("1000 sets") << 1000 << false;
+    QTest::newRow("1000 sets, fast exit") << 1000 << true;
+}
+
+void BenchmarkResourceSet::benchmarkExit()
+{
+    QFETCH(int, count);
+    QFETCH(bool, fast);
+
+    QList<ResourceSet *> sets;
+    for (int i = 0; i < count; i++) {
+        ResourceSet *resourceSet = new ResourceSet("player");
+        resourceSet->addResource(AudioPlaybackType);
+        resourceSet->initAndConnect();
+        sets << resourceSet;
+    }
+    QElapsedTimer wait;
+    wait.start();
+    int connectedSets = 0;
+    while (connectedSets < count && wait.elapsed() < 30000) {
+        QTest::qWait(10);
+        connectedSets = 0;
+        for (int i = 0; i < count; i++) {
+            if (sets.at(i)->isConnectedToManager())
+                connectedSets++;
+        }
+    }
+    QCOMPARE(connectedSets, count);
+
+    // What a process does on its way out: delete its sets and let the
+    // event loop send whatever that queued.
+    QElapsedTimer timer;
+    timer.start();
+    ResourceSet::setFastExit(fast);
+    qDeleteAll(sets);
+    QCoreApplication::processEvents();
+    QTest::setBenchmarkResult(timer.nsecsElapsed() / 1000000.0, QTest::WalltimeMilliseconds);
+
+    ResourceSet::setFastExit(false);
+}
+
 QTEST_MAIN(BenchmarkResourceSet)
@@ -24,9 +24,30 @@ USA.
 
 #include <QObject>
 #include <QList>
+#include <QThread>
 #include <QtTest/QTest>
 #include <policy/resource-set.h>
 
+/**
+* Hammers a shared thread-safe ResourceSet with acquire()/release() pairs
+* and records the ids of the sets it creates meanwhile.
+*/
+class StressThread: public QThread
+{
+    Q_OBJECT
+public:
+    StressThread(ResourcePolicy::ResourceSet *set, int iterations);
+
+    QList<quint32> createdIds;
+
+protected:
+    void run();
+
+private:
+    ResourcePolicy::ResourceSet *set;
+    int iterations;
+};
+
 class BenchmarkResourceSet: public QObject
 {
     Q_OBJECT
@@ -62,6 +83,22 @@ private slots:
     void benchmarkReleaseSend();
     void benchmarkAcquire();
     void benchmarkRelease();
+    void benchmarkColdStart();
+    void benchmarkToggle_data();
+    void benchmarkToggle();
+    void benchmarkHandover_data();
+    void benchmarkHandover();
+    void benchmarkThreadedStress_data();
+    void benchmarkThreadedStress();
+    void benchmarkReconnect_data();
+    void benchmarkReconnect();
+    void benchmarkFirstAcquire_data();
+    void benchmarkFirstAcquire();
+
+    void benchmarkCorkedSyscalls_data();
+    void benchmarkCorkedSyscalls();
+    void benchmarkExit_data();
+    void benchmarkExit();
 };
 
 #endif
@@ -27,15 +27,17 @@ DESTDIR = build
 # Silence qDebug
 DEFINES += QT_NO_DEBUG_OUTPUT
 
-HEADERS += benchmark-resource-set.h
+HEADERS += benchmark-resource-set.h \
+           syscall-counter.h
 
-SOURCES += benchmark-resource-set.cpp
+SOURCES += benchmark-resource-set.cpp \
+           syscall-counter.cpp
 
 OBJECTS_DIR = build
 MOC_DIR = build
 
 QMAKE_CXXFLAGS += -Wall
-LIBS += $${DBUSQEVENTLOOPLIB}
+LIBS += $${DBUSQEVENTLOOPLIB} -ldl
 
 CONFIG  += qt debug warn_on link_pkgconfig
 QT -= gui
@@ -0,0 +1,100 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "syscall-counter.h"
+
+static volatile bool counting = false;
+static volatile unsigned long calls = 0;
+
+static inline void countCall()
+{
+    if (counting)
+        __sync_fetch_and_add(&calls, 1);
+}
+
+// Resolve the libc implementation behind an interposed function once.
+#define NEXT(name, type) \
+    static type next = NULL; \
+    if (next == NULL) \
+        next = (type) dlsym(RTLD_NEXT, name)
+
+extern "C" ssize_t write(int fd, const void *buf, size_t count)
+{
+    NEXT("write", ssize_t (*)(int, const void *, size_t));
+    countCall();
+    return next(fd, buf, count);
+}
+
+extern "C" ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    NEXT("writev", ssize_t (*)(int, const struct iovec *, int));
+    countCall();
+    return next(fd, iov, iovcnt);
+}
+
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    NEXT("send", ssize_t (*)(int, const void *, size_t, int));
+    countCall();
+    return next(fd, buf, len, flags);
+}
+
+extern "C" ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+                          const struct sockaddr *addr, socklen_t addrlen)
+{
+    NEXT("sendto", ssize_t (*)(int, const void *, size_t, int, const struct sockaddr *, socklen_t));
+    countCall();
+    return next(fd, buf, len, flags, addr, addrlen);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    NEXT("sendmsg", ssize_t (*)(int, const struct msghdr *, int));
+    countCall();
+    return next(fd, msg, flags);
+}
+
+void SyscallCounter::start()
+{
+    calls = 0;
+    counting = true;
+}
+
+unsigned long SyscallCounter::stop()
+{
+    counting = false;
+    return calls;
+}
+
+unsigned long SyscallCounter::count()
+{
+    return calls;
+}
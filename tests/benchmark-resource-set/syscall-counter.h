@@ -0,0 +1,38 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef SYSCALL_COUNTER_H
+#define SYSCALL_COUNTER_H
+
+/**
+* Counts the write-side system calls made by the whole process while
+* counting is enabled. write, writev, send, sendto and sendmsg are
+* interposed by syscall-counter.cpp, so linking that file into a benchmark
+* binary is all that is needed.
+*/
+namespace SyscallCounter
+{
+    void start();
+    unsigned long stop();
+    unsigned long count();
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <string.h>
+#include <stdarg.h>
+#include <dbus/dbus.h>
+
+#include "test-allocations.h"
+#include "alloc-counter.h"
+#include "resource-engine.h"
+
+using namespace ResourcePolicy;
+
+const int WARMUP_CYCLES = 16;
+const int MEASURED_CYCLES = 1000;
+// Allocations a warm cycle is allowed to make inside libresourceqt.
+const unsigned long ALLOWED_ALLOCATIONS_PER_CYCLE = 0;
+
+////////////////////////////////////////////////////////////////
+// Stand-in manager. Requests are queued in a fixed array and answered
+// from StandInManager::deliver(), the way the real manager answers
+// them from a later event loop iteration.
+
+namespace StandInManager
+{
+    struct Pending {
+        resset_t *set;
+        resmsg_type_t type;
+        quint32 id;
+        quint32 reqno;
+        resproto_status_t status;
+    };
+
+    const int MAX_PENDING = 16;
+    const int MAX_HANDLERS = 32;
+    static Pending pending[MAX_PENDING];
+    static int pendingCount = 0;
+    static resconn_t *connection = NULL;
+    static resproto_handler_t handlers[MAX_HANDLERS];
+
+    static bool queue(resset_t *set, resmsg_t *message, resproto_status_t status)
+    {
+        if (pendingCount == MAX_PENDING)
+            return false;
+        Pending &p = pending[pendingCount++];
+        p.set = set;
+        p.type = message->type;
+        p.id = message->any.id;
+        p.reqno = message->any.reqno;
+        p.status = status;
+        return true;
+    }
+
+    static void sendStatus(const Pending &p)
+    {
+        resmsg_t reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = RESMSG_STATUS;
+        reply.status.id = p.id;
+        reply.status.reqno = p.reqno;
+        reply.status.errcod = 0;
+        reply.status.errmsg = const_cast<char *>("OK");
+        p.status(p.set, &reply);
+    }
+
+    static void sendGrant(const Pending &p, uint32_t resources)
+    {
+        resmsg_t reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = RESMSG_GRANT;
+        reply.notify.id = p.id;
+        reply.notify.reqno = p.reqno;
+        reply.notify.resrc = resources;
+        if (handlers[RESMSG_GRANT])
+            handlers[RESMSG_GRANT](&reply, p.set, p.set->userdata);
+    }
+
+    static void deliver()
+    {
+        // Handlers may queue new requests, only answer what is queued now.
+        int count = pendingCount;
+        Pending answered[MAX_PENDING];
+        memcpy(answered, pending, sizeof(Pending) * count);
+        pendingCount = 0;
+
+        for (int i = 0; i < count; i++) {
+            const Pending &p = answered[i];
+            sendStatus(p);
+            switch (p.type) {
+            case RESMSG_ACQUIRE:
+                sendGrant(p, RESMSG_AUDIO_PLAYBACK);
+                break;
+            case RESMSG_RELEASE:
+                sendGrant(p, 0);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+DBusConnection *dbus_bus_get_private(DBusBusType, DBusError *)
+{
+    // No bus is needed, the stand-in manager lives in this process.
+    return NULL;
+}
+
+resconn_t *resproto_init(resproto_role_t, resproto_transport_t, ...)
+{
+    StandInManager::connection = (resconn_t *) calloc(1, sizeof(resconn_t));
+    return StandInManager::connection;
+}
+
+int resproto_set_handler(union resconn_u *, resmsg_type_t type,
+                         resproto_handler_t callbackFunction)
+{
+    if (type >= 0 && type < StandInManager::MAX_HANDLERS)
+        StandInManager::handlers[type] = callbackFunction;
+    return 1;
+}
+
+resset_t *resconn_connect(resconn_t *, resmsg_t *message,
+                          resproto_status_t callbackFunction)
+{
+    resset_t *set = (resset_t *) calloc(1, sizeof(resset_t));
+    set->id = message->record.id;
+    StandInManager::queue(set, message, callbackFunction);
+    return set;
+}
+
+int resconn_disconnect(resset_t *, resmsg_t *, resproto_status_t)
+{
+    return 1;
+}
+
+int resproto_send_message(resset_t *set, resmsg_t *message,
+                          resproto_status_t callbackFunction)
+{
+    return StandInManager::queue(set, message, callbackFunction) ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+TestAllocations::TestAllocations()
+    : resourceSet(NULL), granted(0), released(0)
+{
+}
+
+TestAllocations::~TestAllocations()
+{
+}
+
+void TestAllocations::grantedHandler(const QList<ResourceType> &)
+{
+    granted++;
+}
+
+void TestAllocations::releasedHandler()
+{
+    released++;
+}
+
+void TestAllocations::initTestCase()
+{
+    resourceSet = new ResourceSet("player", this, true, false);
+    resourceSet->addResource(AudioPlaybackType);
+
+    QObject::connect(resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)),
+                     this, SLOT(grantedHandler(const QList<ResourcePolicy::ResourceType> &)));
+    QObject::connect(resourceSet, SIGNAL(resourcesReleased()),
+                     this, SLOT(releasedHandler()));
+
+    QVERIFY(resourceSet->initAndConnect());
+    StandInManager::deliver();
+    QVERIFY(resourceSet->isConnectedToManager());
+}
+
+void TestAllocations::cleanupTestCase()
+{
+    delete resourceSet;
+    resourceSet = NULL;
+}
+
+void TestAllocations::cycle()
+{
+    resourceSet->acquire();
+    StandInManager::deliver();
+    resourceSet->release();
+    StandInManager::deliver();
+}
+
+void TestAllocations::testSteadyStateCycle()
+{
+    for (int i = 0; i < WARMUP_CYCLES; i++)
+        cycle();
+
+    granted = 0;
+    released = 0;
+
+    AllocCounter::start();
+    for (int i = 0; i < MEASURED_CYCLES; i++)
+        cycle();
+    unsigned long allocations = AllocCounter::stop();
+
+    QCOMPARE(granted, MEASURED_CYCLES);
+    QCOMPARE(released, MEASURED_CYCLES);
+
+    qWarning("%d cycles made %lu allocations (%lu bytes), %.3f per cycle",
+             MEASURED_CYCLES, allocations, (unsigned long) AllocCounter::bytes(),
+             (double) allocations / MEASURED_CYCLES);
+
+    QVERIFY(allocations <= ALLOWED_ALLOCATIONS_PER_CYCLE * MEASURED_CYCLES);
+}
+
+QTEST_MAIN(TestAllocations)
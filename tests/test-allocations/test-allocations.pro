@@ -0,0 +1,63 @@
+##############################################################################
+#  This file is part of libresourceqt                                        #
+#                                                                            #
+#  Copyright (C) 2011 Nokia Corporation.                                     #
+#                                                                            #
+#  This library is free software; you can redistribute                       #
+#  it and/or modify it under the terms of the GNU Lesser General Public      #
+#  License as published by the Free Software Foundation                      #
+#  version 2.1 of the License.                                               #
+#                                                                            #
+#  This library is distributed in the hope that it will be useful,           #
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of            #
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU          #
+#  Lesser General Public License for more details.                           #
+#                                                                            #
+#  You should have received a copy of the GNU Lesser General Public          #
+#  License along with this library; if not, write to the Free Software       #
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  #
+#  USA.                                                                      #
+##############################################################################
+
+include(../test_common.pri)
+TEMPLATE = app
+TARGET = test-allocations
+DESTDIR = build
+DEPENDPATH += $${LIBRESOURCEQT}/src .
+INCLUDEPATH += $${LIBRESOURCEQT}/src $${LIBDBUSQEVENTLOOP}
+
+# Silence qDebug
+DEFINES += QT_NO_DEBUG_OUTPUT
+
+# The library is compiled in so that the libresource protocol calls
+# resolve to the stand-in manager in test-allocations.cpp.
+HEADERS +=  $${PUBLIC_INCLUDE}/policy/resource.h \
+            $${PUBLIC_INCLUDE}/policy/resources.h \
+            $${PUBLIC_INCLUDE}/policy/resource-set.h \
+            $${PUBLIC_INCLUDE}/policy/audio-resource.h \
+            $${LIBRESOURCEQT}/src/resource-engine.h \
+            alloc-counter.h \
+            test-allocations.h
+
+SOURCES +=  $${LIBRESOURCEQT}/src/resource.cpp \
+            $${LIBRESOURCEQT}/src/resources.cpp \
+            $${LIBRESOURCEQT}/src/resource-set.cpp \
+            $${LIBRESOURCEQT}/src/resource-engine.cpp \
+            $${LIBRESOURCEQT}/src/audio-resource.cpp \
+            alloc-counter.cpp \
+            test-allocations.cpp
+
+OBJECTS_DIR = build
+MOC_DIR = build
+
+QMAKE_CXXFLAGS += -Wall
+LIBS -= $$RESOURCEQTLIB
+LIBS += $${DBUSQEVENTLOOPLIB}
+
+CONFIG  += qt debug warn_on link_pkgconfig
+QT += testlib
+QT -= gui
+PKGCONFIG += dbus-1 libresource
+
+target.path    = $$[QT_INSTALL_LIBS]/$${TESTSTARGETDIR}/
+INSTALLS       = target
@@ -205,4 +205,39 @@ void TestAudioResource::testSetStreamTag()
     delete audioResource;
 }
 
+void TestAudioResource::testPropertyTransaction()
+{
+    AudioResource *audioResource = new AudioResource;
+    QVERIFY(audioResource);
+
+    QSignalSpy stateSpy(audioResource,
+            SIGNAL(audioPropertiesChanged(const QString&, quint32,
+            const QString&, const QString &)));
+    QVERIFY(stateSpy.isValid());
+
+    // Nested transactions emit once, on the outermost commit
+    audioResource->beginPropertyChanges();
+    audioResource->setAudioGroup("foobar");
+    audioResource->beginPropertyChanges();
+    audioResource->setProcessID(2345);
+    audioResource->commitPropertyChanges();
+    audioResource->setStreamTag("tagname", "tagvalue");
+    QCOMPARE(stateSpy.count(), 0);
+    audioResource->commitPropertyChanges();
+
+    QCOMPARE(stateSpy.count(), 1);
+    QList<QVariant> signalArgs = stateSpy.takeFirst();
+    QCOMPARE(signalArgs.at(0).toString(), QString("foobar"));
+    QCOMPARE(signalArgs.at(1).toUInt(), (quint32) 2345);
+    QCOMPARE(signalArgs.at(2).toString(), QString("tagname"));
+    QCOMPARE(signalArgs.at(3).toString(), QString("tagvalue"));
+
+    // An empty transaction emits nothing
+    audioResource->beginPropertyChanges();
+    audioResource->commitPropertyChanges();
+    QCOMPARE(stateSpy.count(), 0);
+
+    delete audioResource;
+}
+
 QTEST_MAIN(TestAudioResource)
@@ -46,6 +46,7 @@ private slots:
     void testSetAudioGroup();
     void testSetProcessId();
     void testSetStreamTag();
+    void testPropertyTransaction();
 };
 
 #endif // TESTAUDIORESOURCE_H
@@ -0,0 +1,117 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <QEventLoop>
+#include <QFile>
+#include <QTimer>
+#include <dbusconnectioneventloop.h>
+#include "test-idle-wakeups.h"
+
+using namespace ResourcePolicy;
+
+// Length of the idle phase, overridable with TEST_IDLE_SECONDS.
+#define IDLE_SECONDS 60
+
+// Voluntary context switches allowed per idle minute in low-wakeup mode.
+#define MAX_LOW_WAKEUP_SWITCHES_PER_MINUTE 60
+
+TestIdleWakeups::TestIdleWakeups()
+    : idleSeconds(IDLE_SECONDS)
+{
+}
+
+long TestIdleWakeups::voluntarySwitches()
+{
+    QFile status("/proc/self/status");
+
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return -1;
+
+    while (!status.atEnd()) {
+        QByteArray line = status.readLine();
+
+        if (line.startsWith("voluntary_ctxt_switches:"))
+            return line.mid(line.indexOf(':') + 1).trimmed().toLong();
+    }
+
+    return -1;
+}
+
+void TestIdleWakeups::idle(int seconds)
+{
+    QEventLoop loop;
+    QTimer::singleShot(seconds * 1000, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+void TestIdleWakeups::initTestCase()
+{
+    int seconds = qgetenv("TEST_IDLE_SECONDS").toInt();
+    if (seconds > 0)
+        idleSeconds = seconds;
+
+    if (voluntarySwitches() < 0)
+        QSKIP("voluntary_ctxt_switches not available in /proc/self/status");
+}
+
+void TestIdleWakeups::testIdle_data()
+{
+    QTest::addColumn<bool>("lowWakeup");
+
+    QTest::newRow("default") << false;
+    QTest::newRow("low-wakeup") << true;
+}
+
+void TestIdleWakeups::testIdle()
+{
+    QFETCH(bool, lowWakeup);
+
+    DBUSConnectionEventLoop::setLowWakeupMode(lowWakeup);
+
+    ResourceSet resourceSet("player");
+    resourceSet.addResource(AudioPlaybackType);
+
+    QEventLoop loop;
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.connect(&resourceSet, SIGNAL(managerIsUp()), SLOT(quit()));
+    resourceSet.initAndConnect();
+    loop.exec();
+
+    QVERIFY(resourceSet.isConnectedToManager());
+
+    // Let the connection settle before measuring.
+    idle(1);
+
+    long before = voluntarySwitches();
+    idle(idleSeconds);
+    long switches = voluntarySwitches() - before;
+
+    long perMinute = switches * 60 / idleSeconds;
+    qWarning("%s: %ld voluntary context switches in %d s idle, %ld per minute",
+             QTest::currentDataTag(), switches, idleSeconds, perMinute);
+
+    if (lowWakeup)
+        QVERIFY(perMinute <= MAX_LOW_WAKEUP_SWITCHES_PER_MINUTE);
+
+    DBUSConnectionEventLoop::setLowWakeupMode(false);
+}
+
+QTEST_MAIN(TestIdleWakeups)
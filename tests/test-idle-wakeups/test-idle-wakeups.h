@@ -0,0 +1,52 @@
+/*************************************************************************
+This file is part of libresourceqt
+
+Copyright (C) 2011 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef TEST_IDLE_WAKEUPS_H
+#define TEST_IDLE_WAKEUPS_H
+
+#include <QObject>
+#include <QtTest/QTest>
+#include <policy/resource-set.h>
+
+/**
+ * Counts the voluntary context switches of an otherwise idle process that
+ * holds a ResourceSet connected to the manager, with and without the
+ * low-wakeup mode of the D-Bus event loop.
+ */
+class TestIdleWakeups: public QObject
+{
+    Q_OBJECT
+public:
+    TestIdleWakeups();
+
+private:
+    static long voluntarySwitches();
+    void idle(int seconds);
+
+    int idleSeconds;
+
+private slots:
+    void initTestCase();
+    void testIdle_data();
+    void testIdle();
+};
+
+#endif
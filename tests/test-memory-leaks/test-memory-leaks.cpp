@@ -19,82 +19,275 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
 USA.
 *************************************************************************/
 
+#include <QCoreApplication>
+#include <QDir>
+#include <QStringList>
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
 
 #include "test-memory-leaks.h"
-#include <cassert>
 
 const int ITERATIONS = 20000;
+const int SAMPLE_INTERVAL = 250;
+const int WARMUP = 1000;
+const int RECREATE_INTERVAL = 100;
+const int REPLY_TIMEOUT = 5000;
+
+// Allowed growth per iteration once warmed up.
+const double MAX_RSS_SLOPE = 16.0;      // bytes
+const double MAX_HEAP_SLOPE = 8.0;      // bytes
+const double MAX_FD_SLOPE = 0.0005;     // descriptors
+
+MemoryLeakTest::MemoryLeakTest(QObject *parent)
+    : QObject(parent), set(NULL), state(Acquiring), iterations(ITERATIONS),
+      iteration(0), sampleInterval(SAMPLE_INTERVAL), warmup(WARMUP),
+      recreateInterval(RECREATE_INTERVAL), maxRssSlope(MAX_RSS_SLOPE),
+      maxHeapSlope(MAX_HEAP_SLOPE), maxFdSlope(MAX_FD_SLOPE)
+{
+    watchdog.setSingleShot(true);
+    watchdog.setInterval(REPLY_TIMEOUT);
+    connect(&watchdog, SIGNAL(timeout()), this, SLOT(timeoutHandler()));
+}
 
-void MemoryLeakTest::test() {
-  set = new ResourceSet("player", this);
-
-  iterations = ITERATIONS;
+MemoryLeakTest::~MemoryLeakTest()
+{
+    delete set;
+}
 
-  AudioResource *audioResource = new ResourcePolicy::AudioResource();
-  set->addResourceObject(audioResource);
+bool MemoryLeakTest::parseArguments(const QStringList &args)
+{
+    for (int i = 1; i < args.size(); i++) {
+        QString arg = args.at(i);
+        if (i + 1 >= args.size()) {
+            printf("missing value for %s\n", qPrintable(arg));
+            return false;
+        }
+        QString value = args.at(++i);
+        if (arg == "-n")
+            iterations = value.toInt();
+        else if (arg == "-s")
+            sampleInterval = qMax(1, value.toInt());
+        else if (arg == "-w")
+            warmup = value.toInt();
+        else if (arg == "-r")
+            recreateInterval = value.toInt();
+        else if (arg == "-R")
+            maxRssSlope = value.toDouble();
+        else if (arg == "-H")
+            maxHeapSlope = value.toDouble();
+        else if (arg == "-F")
+            maxFdSlope = value.toDouble();
+        else {
+            printf("usage: test-memory-leaks [-n iterations] [-s sample-interval] "
+                   "[-w warmup] [-r recreate-interval] [-R max-rss-slope] "
+                   "[-H max-heap-slope] [-F max-fd-slope]\n");
+            return false;
+        }
+    }
+    return true;
+}
 
-  connect(set,  SIGNAL(resourcesGranted(QList<ResourcePolicy::ResourceType>)),
-         this, SLOT(resourceAcquiredHandler(QList<ResourcePolicy::ResourceType>)));
+void MemoryLeakTest::createSet()
+{
+    delete set;
+    set = new ResourceSet("player", this, true, false);
 
-  connect(set, SIGNAL(resourcesReleased()), this, SLOT(resourceReleasedHandler()));
+    AudioResource *audioResource = new ResourcePolicy::AudioResource();
+    set->addResourceObject(audioResource);
 
-  set->acquire();
+    connect(set, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)),
+            this, SLOT(resourceAcquiredHandler(const QList<ResourcePolicy::ResourceType> &)));
+    connect(set, SIGNAL(resourcesReleased()), this, SLOT(resourceReleasedHandler()));
+    connect(set, SIGNAL(updateOK()), this, SLOT(updateOKHandler()));
 }
 
+void MemoryLeakTest::test()
+{
+    createSet();
+    state = Acquiring;
+    watchdog.start();
+    set->acquire();
+}
 
-void MemoryLeakTest::resourceAcquiredHandler(QList<ResourceType> notused)
+void MemoryLeakTest::resourceAcquiredHandler(const QList<ResourceType> &)
 {
-  (void) notused;
-  QList<Resource*> list = set->resources();
-    if (list.count() == 0) {
-        printf("Granted resource set is empty\n");
+    watchdog.start();
+
+    if (state == Acquiring) {
+        // Toggle an optional resource so that every other update adds
+        // and every other update deletes a resource object.
+        if (set->contains(VideoPlaybackType)) {
+            set->deleteResource(VideoPlaybackType);
+        } else {
+            set->addResource(VideoPlaybackType);
+            set->resource(VideoPlaybackType)->setOptional();
+        }
+        state = Updating;
+        set->update();
+    } else if (state == Updating) {
+        state = Releasing;
+        set->release();
     }
-    else {
-      for (int i = 0; i < list.count(); i++) {
-        //printf("Granted resource %d\n", (int)list[i]);
-      }
+}
 
-      set->release();
+void MemoryLeakTest::updateOKHandler()
+{
+    if (state != Updating)
+        return;
 
-    }
+    watchdog.start();
+    state = Releasing;
+    set->release();
 }
 
 void MemoryLeakTest::resourceReleasedHandler()
 {
+    if (state != Releasing)
+        return;
+
+    iteration++;
+    if (iteration % sampleInterval == 0)
+        sample();
+
+    if (iteration >= iterations) {
+        watchdog.stop();
+        QCoreApplication::exit(report());
+        return;
+    }
+
+    nextIteration();
+}
+
+void MemoryLeakTest::nextIteration()
+{
+    if (recreateInterval > 0 && iteration % recreateInterval == 0) {
+        // Destroy the set from the event loop, not from inside its own signal.
+        set->disconnect(this);
+        set->deleteLater();
+        set = NULL;
+        createSet();
+    }
+
+    state = Acquiring;
+    watchdog.start();
     set->acquire();
-    iterations--;
-    printf("iteration %d\n", (ITERATIONS-iterations+1));
-    if (iterations <= 0)  exit(0);
+}
+
+void MemoryLeakTest::timeoutHandler()
+{
+    printf("no reply from the manager in iteration %d (state %d)\n", iteration, state);
+    QCoreApplication::exit(2);
+}
+
+void MemoryLeakTest::sample()
+{
+    MemorySample memorySample;
+    memorySample.iteration = iteration;
+
+    if (!update_memory_stat(memorySample)) {
+        printf("failed to read memory statistics\n");
+        return;
+    }
+
+    printf("iteration %6d: rss %10.0f heap %10.0f fds %4.0f\n", iteration,
+           memorySample.rss, memorySample.heap, memorySample.fds);
+
+    if (iteration > warmup)
+        samples.append(memorySample);
+}
+
+double MemoryLeakTest::slope(const QList<MemorySample> &samples, double MemorySample::*field)
+{
+    // Least squares fit of field against iteration.
+    int n = samples.size();
+    if (n < 2)
+        return 0.0;
+
+    double sumX = 0.0, sumY = 0.0, sumXY = 0.0, sumXX = 0.0;
+    for (int i = 0; i < n; i++) {
+        double x = samples.at(i).iteration;
+        double y = samples.at(i).*field;
+        sumX += x;
+        sumY += y;
+        sumXY += x * y;
+        sumXX += x * x;
+    }
+
+    double denominator = n * sumXX - sumX * sumX;
+    if (denominator == 0.0)
+        return 0.0;
 
+    return (n * sumXY - sumX * sumY) / denominator;
+}
+
+int MemoryLeakTest::report()
+{
+    if (samples.size() < 2) {
+        printf("not enough samples after warm-up (%d), increase -n or decrease -s/-w\n",
+               samples.size());
+        return 1;
+    }
+
+    double rssSlope = slope(samples, &MemorySample::rss);
+    double heapSlope = slope(samples, &MemorySample::heap);
+    double fdSlope = slope(samples, &MemorySample::fds);
+
+    printf("growth per iteration: rss %.3f bytes (max %.3f), heap %.3f bytes (max %.3f), "
+           "fds %.6f (max %.6f)\n", rssSlope, maxRssSlope, heapSlope, maxHeapSlope,
+           fdSlope, maxFdSlope);
+
+    int failures = 0;
+    if (rssSlope > maxRssSlope) {
+        printf("FAIL: RSS keeps growing\n");
+        failures++;
+    }
+    if (heapSlope > maxHeapSlope) {
+        printf("FAIL: heap keeps growing\n");
+        failures++;
+    }
+    if (fdSlope > maxFdSlope) {
+        printf("FAIL: file descriptors are leaking\n");
+        failures++;
+    }
+    if (failures == 0)
+        printf("PASS\n");
+
+    return failures ? 1 : 0;
 }
 
 #define STATUS_BUF_SIZE 2047
 static char status_buf[STATUS_BUF_SIZE+1];
 
-void MemoryLeakTest::update_memory_stat()
+bool MemoryLeakTest::update_memory_stat(MemorySample &sample)
 {
-    const int MAX_NAME = 100;
-    char filename[MAX_NAME + 1];
-    filename[MAX_NAME] = '\0';
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+        return false;
 
-    snprintf(filename, MAX_NAME, "/proc/%d/status", getpid());
-    FILE* status = fopen(filename, "r");
-    fread(status_buf, 1, STATUS_BUF_SIZE, status);
+    size_t len = fread(status_buf, 1, STATUS_BUF_SIZE, status);
     fclose(status);
+    status_buf[len] = '\0';
 
-    char *ptr = strstr(status_buf, "VmSize:");
-
-    int retcnt = 0;
+    char *ptr = strstr(status_buf, "VmRSS:");
+    long rssKb = 0;
+    if (ptr == NULL || sscanf(ptr + 6, "%ld", &rssKb) != 1)
+        return false;
+    sample.rss = rssKb * 1024.0;
 
-    assert(ptr);
-/*
-    if (ptr)  retcnt = sscanf(ptr+7, "%d", &vm_size);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    sample.heap = (double) info.uordblks + (double) info.hblkhd;
 
-    if( retcnt != 1 )
-        return FALSE;
+    // Subtract the descriptor QDir itself holds open while listing.
+    sample.fds = QDir("/proc/self/fd").entryList(QDir::Files | QDir::System).size() - 1;
 
-    return TRUE;*/
+    return true;
 }
 
 
@@ -102,10 +295,12 @@ int main(int argc, char* argv[]) {
 
   QCoreApplication app(argc, argv);
 
-  MemoryLeakTest *leaks = new MemoryLeakTest();
+  MemoryLeakTest leaks;
+
+  if (!leaks.parseArguments(app.arguments()))
+      return 1;
 
-  leaks->test();
+  leaks.test();
 
   return app.exec();
-  delete leaks;
 }
@@ -19,27 +19,73 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
 USA.
 *************************************************************************/
 
+#ifndef TEST_MEMORY_LEAKS_H
+#define TEST_MEMORY_LEAKS_H
 
-
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QTimer>
 #include <policy/resource-set.h>
 
 using namespace ResourcePolicy;
 
+/**
+* One sample of the process footprint taken during the soak run.
+*/
+struct MemorySample
+{
+    int iteration;
+    double rss;         ///< VmRSS in bytes
+    double heap;        ///< bytes in use by malloc
+    double fds;         ///< number of open file descriptors
+};
+
+/**
+* Soak harness: cycles acquire, update (adding and deleting a resource),
+* release and set create/destroy, samples RSS, heap and open fds every
+* sampleInterval iterations, and fits a growth slope to each series once
+* the run is over. The run fails if any slope exceeds its threshold.
+*/
 class MemoryLeakTest : public QObject {
   Q_OBJECT
   Q_DISABLE_COPY(MemoryLeakTest)
 public:
-  MemoryLeakTest(QObject *parent = NULL) : QObject(parent)  {}
+  MemoryLeakTest(QObject *parent = NULL);
+  ~MemoryLeakTest();
 
-  void update_memory_stat();
+  bool parseArguments(const QStringList &args);
   void test();
 
+  static bool update_memory_stat(MemorySample &sample);
+  static double slope(const QList<MemorySample> &samples, double MemorySample::*field);
+
 private:
+  enum State { Acquiring = 0, Updating, Releasing };
+
   ResourceSet *set;
+  State state;
   int iterations;
+  int iteration;
+  int sampleInterval;
+  int warmup;
+  int recreateInterval;
+  double maxRssSlope;
+  double maxHeapSlope;
+  double maxFdSlope;
+  QList<MemorySample> samples;
+  QTimer watchdog;
+
+  void createSet();
+  void nextIteration();
+  void sample();
+  int report();
 
 private slots:
-  void resourceAcquiredHandler(QList<ResourcePolicy::ResourceType> grantedResList);
+  void resourceAcquiredHandler(const QList<ResourcePolicy::ResourceType> &grantedResList);
   void resourceReleasedHandler();
-
+  void updateOKHandler();
+  void timeoutHandler();
 };
+
+#endif
@@ -19,21 +19,23 @@
 #  USA.                                                                      #
 ##############################################################################
 
-include(../../common.pri)
+include(../test_common.pri)
 TEMPLATE = app
 TARGET = test-memory-leaks
 DESTDIR = build
-DEPENDPATH += $${POLICY} $${BASE}/src .
-INCLUDEPATH += $${LIBRESOURCEQT}/src $${LIBRESOURCEQT}/include $${LIBRESOURCEINC} $${LIBDBUSQEVENTLOOP}
 
-# Input
+# Silence qDebug
+DEFINES += QT_NO_DEBUG_OUTPUT
+
 HEADERS += test-memory-leaks.h
-SOURCES += test-memory-leaks.cpp 
+
+SOURCES += test-memory-leaks.cpp
 
 OBJECTS_DIR = build
 MOC_DIR = build
 
-LIBS += -L$${LIBDBUSQEVENTLOOP}/build -L$${LIBRESOURCEQT}/build -ldbus-qeventloop -lresourceqt
+QMAKE_CXXFLAGS += -Wall
+LIBS += $${DBUSQEVENTLOOPLIB}
 
 CONFIG  += qt debug warn_on link_pkgconfig
 QT -= gui
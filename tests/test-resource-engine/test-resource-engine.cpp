@@ -24,6 +24,8 @@ USA.
 #include <QByteArray>
 #include <QList>
 #include <QtDebug>
+#include <QSignalSpy>
+#include <QElapsedTimer>
 #include <dbus/dbus.h>
 #include <string.h>
 
@@ -327,6 +329,77 @@ void TestResourceEngine::testMultipleInstences()
     delete(resSet);
 }
 
+void TestResourceEngine::testWatchdog()
+{
+    QObject::connect(resourceEngine, SIGNAL(connectionDegraded(const QStringList &)),
+                     resourceSet, SIGNAL(managerDegraded(const QStringList &)));
+    QObject::connect(resourceEngine, SIGNAL(requestsTimedOut(const QStringList &)),
+                     resourceSet, SLOT(handleRequestsTimedOut(const QStringList &)));
+    QSignalSpy degradedSpy(resourceSet, SIGNAL(managerDegraded(const QStringList &)));
+    QSignalSpy timedOutSpy(resourceSet, SIGNAL(managerTimedOut(const QStringList &)));
+
+    resourceEngine->setWatchdog(1000, 0);
+    resourceEngine->connectToManager();
+    resourceEngine->handleStatusMessage(resourceEngine->requestId);
+    QVERIFY(resourceEngine->isConnectedToManager());
+
+    QElapsedTimer clock;
+    clock.start();
+    qint64 now = clock.msecsSinceReference();
+
+    // Recent requests are left alone
+    resourceEngine->messageMap.insert(100, RESMSG_ACQUIRE, now - 100);
+    resourceEngine->checkHealth();
+    QCOMPARE(degradedSpy.count(), 0);
+    QCOMPARE(timedOutSpy.count(), 0);
+
+    // After half of the timeout the manager is reported slow, once
+    resourceEngine->messageMap.insert(101, RESMSG_UPDATE, now - 600);
+    resourceEngine->checkHealth();
+    resourceEngine->checkHealth();
+    QCOMPARE(degradedSpy.count(), 1);
+    QCOMPARE(degradedSpy.at(0).at(0).toStringList(), QStringList() << "update");
+    QCOMPARE(timedOutSpy.count(), 0);
+
+    // After the whole timeout the registration is dropped
+    resourceEngine->messageMap.insert(102, RESMSG_RELEASE, now - 1100);
+    resourceEngine->checkHealth();
+    QCOMPARE(timedOutSpy.count(), 1);
+    QCOMPARE(timedOutSpy.at(0).at(0).toStringList(), QStringList() << "release");
+    QVERIFY(!resourceEngine->isConnectedToManager());
+    QVERIFY(!resourceEngine->messageMap.hasUnanswered());
+    QVERIFY(resourceEngine->reconnectTimer != 0);
+
+    // No REGISTER goes out before the back-off has passed
+    QVERIFY(resourceEngine->connectToManager());
+    QVERIFY(!resourceEngine->isConnectingToManager());
+
+    // A deleted set stops the timers
+    resourceEngine->disconnectFromManager();
+    QCOMPARE(resourceEngine->watchdogTimer, 0);
+    QCOMPARE(resourceEngine->reconnectTimer, 0);
+}
+
+void TestResourceEngine::testTimeoutDropsCorkedMessages()
+{
+    resourceEngine->connectToManager();
+    resourceEngine->handleStatusMessage(resourceEngine->requestId);
+
+    resourceEngine->cork();
+    QVERIFY(resourceEngine->acquireResources());
+    QCOMPARE(resourceEngine->corkedMessages.size(), 1);
+
+    // The held back acquire belongs to the dropped registration
+    resourceEngine->handleTimeout(QStringList() << "acquire");
+    QVERIFY(resourceEngine->corkedMessages.isEmpty());
+    resourceEngine->uncork();
+    resourceEngine->flushCorkedMessages();
+
+    // Nothing is sent without a registration
+    QVERIFY(!resourceEngine->acquireResources());
+    QVERIFY(!resourceEngine->messageMap.hasUnanswered());
+}
+
 QTEST_MAIN(TestResourceEngine)
 
 ////////////////////////////////////////////////////////////////
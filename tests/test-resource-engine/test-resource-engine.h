@@ -78,6 +78,9 @@ private slots:
     void testRegisterAudioProperties();
 
     void testMultipleInstences();
+
+    void testWatchdog();
+    void testTimeoutDropsCorkedMessages();
 };
 
 #endif
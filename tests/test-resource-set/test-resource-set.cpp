@@ -23,6 +23,9 @@ USA.
 #include <QList>
 #include <QEventLoop>
 #include <QTimer>
+#include <QCoreApplication>
+#include <QThread>
+#include <res-msg.h>
 #include "test-resource-set.h"
 
 using namespace ResourcePolicy;
@@ -274,6 +277,141 @@ void TestResourceSet::testSetAlwaysReplyNoInit()
     QVERIFY(isSet);
 }
 
+void TestResourceSet::testAdviceResources()
+{
+    ResourceSet resourceSet("player");
+    QVERIFY(resourceSet.adviceResources().isEmpty());
+
+    QList<ResourceType> types;
+    types << AudioPlaybackType << VideoPlaybackType;
+    resourceSet.setAdviceResources(types);
+    QCOMPARE(resourceSet.adviceResources(), types);
+
+    resourceSet.setAdviceResources(QList<ResourceType>());
+    QVERIFY(resourceSet.adviceResources().isEmpty());
+}
+
+// Feeds advice the way the engine does, through the private slot.
+void TestResourceSet::testAdviceDelivery()
+{
+    ResourceSet resourceSet("player");
+    QVERIFY(resourceSet.addResource(AudioPlaybackType));
+    QVERIFY(resourceSet.addResource(VideoPlaybackType));
+    QSignalSpy adviceSpy(&resourceSet,
+            SIGNAL(resourcesBecameAvailable(const QList<ResourcePolicy::ResourceType> &)));
+    QVERIFY(adviceSpy.isValid());
+    QVERIFY(connect(&resourceSet,
+            SIGNAL(resourcesBecameAvailable(const QList<ResourcePolicy::ResourceType> &)),
+            this, SLOT(handleResourcesBecameAvailable(const QList<ResourcePolicy::ResourceType> &))));
+
+    QList<ResourceType> audio;
+    audio << AudioPlaybackType;
+    resourceSet.setAdviceResources(audio);
+
+    // Advice about resources outside the filter is dropped
+    QMetaObject::invokeMethod(&resourceSet, "handleResourcesBecameAvailable",
+                              Q_ARG(quint32, RESMSG_VIDEO_PLAYBACK));
+    QCoreApplication::processEvents();
+    QCOMPARE(adviceSpy.count(), 0);
+
+    // Advice arriving within one event loop iteration is coalesced, the
+    // last one wins and is filtered
+    QMetaObject::invokeMethod(&resourceSet, "handleResourcesBecameAvailable",
+                              Q_ARG(quint32, RESMSG_VIDEO_PLAYBACK));
+    QMetaObject::invokeMethod(&resourceSet, "handleResourcesBecameAvailable",
+                              Q_ARG(quint32, RESMSG_AUDIO_PLAYBACK | RESMSG_VIDEO_PLAYBACK));
+    QCoreApplication::processEvents();
+    QCOMPARE(adviceSpy.count(), 1);
+    QCOMPARE(advisedResources, audio);
+
+    // The same advice again is suppressed
+    QMetaObject::invokeMethod(&resourceSet, "handleResourcesBecameAvailable",
+                              Q_ARG(quint32, RESMSG_AUDIO_PLAYBACK));
+    QCoreApplication::processEvents();
+    QCOMPARE(adviceSpy.count(), 1);
+
+    // A denial ends the episode, the advice counts as new again
+    QMetaObject::invokeMethod(&resourceSet, "handleDeny");
+    QMetaObject::invokeMethod(&resourceSet, "handleResourcesBecameAvailable",
+                              Q_ARG(quint32, RESMSG_AUDIO_PLAYBACK));
+    QCoreApplication::processEvents();
+    QCOMPARE(adviceSpy.count(), 2);
+    QCOMPARE(advisedResources, audio);
+
+    // Without a filter every resource in the advice is reported
+    resourceSet.setAdviceResources(QList<ResourceType>());
+    QMetaObject::invokeMethod(&resourceSet, "handleResourcesBecameAvailable",
+                              Q_ARG(quint32, RESMSG_AUDIO_PLAYBACK | RESMSG_VIDEO_PLAYBACK));
+    QCoreApplication::processEvents();
+    QCOMPARE(adviceSpy.count(), 3);
+    QCOMPARE(advisedResources, QList<ResourceType>() << AudioPlaybackType << VideoPlaybackType);
+}
+
+void TestResourceSet::testRequestTimeout()
+{
+    ResourceSet resourceSet("player");
+    QCOMPARE(resourceSet.requestTimeout(), 0);
+    QCOMPARE(resourceSet.probeInterval(), 0);
+
+    resourceSet.setRequestTimeout(2000);
+    resourceSet.setProbeInterval(500);
+    QCOMPARE(resourceSet.requestTimeout(), 2000);
+    QCOMPARE(resourceSet.probeInterval(), 500);
+
+    resourceSet.setRequestTimeout(-1);
+    QCOMPARE(resourceSet.requestTimeout(), 0);
+}
+
+void TestResourceSet::testSetLazy()
+{
+    ResourceSet resourceSet("player");
+    QVERIFY(!resourceSet.isLazy());
+    QVERIFY(resourceSet.setLazy());
+    QVERIFY(resourceSet.isLazy());
+
+    // Configuring the audio stream must not connect a lazy set
+    QSignalSpy managerSpy(&resourceSet, SIGNAL(managerIsUp()));
+    AudioResource *audioResource = new AudioResource("player");
+    audioResource->setProcessID(QCoreApplication::applicationPid());
+    audioResource->setStreamTag("media.name", "lazy");
+    resourceSet.addResourceObject(audioResource);
+    waitForSignal(&resourceSet, SIGNAL(managerIsUp()), 500);
+    QCOMPARE(managerSpy.count(), 0);
+    QVERIFY(!resourceSet.isConnectedToManager());
+}
+
+void TestResourceSet::testStaticResourceSet()
+{
+    typedef StaticResourceSet<Mandatory<AudioPlaybackType>, Optional<VideoPlaybackType> > PlayerSet;
+    static_assert(PlayerSet::hasType(AudioPlaybackType), "audio is in the set");
+    static_assert(!PlayerSet::hasType(VibraType), "vibra is not in the set");
+    static_assert(PlayerSet::hasOptionalType(VideoPlaybackType), "video is optional");
+    static_assert(PlayerSet::mandatoryTypes == (1u << AudioPlaybackType), "audio is mandatory");
+    static_assert(!PlayerSet::isSatisfiedBy(1u << VideoPlaybackType), "audio is needed");
+
+    PlayerSet resourceSet("player");
+    QVERIFY(resourceSet.contains(AudioPlaybackType));
+    QVERIFY(resourceSet.contains(VideoPlaybackType));
+    QVERIFY(!resourceSet.resource(AudioPlaybackType)->isOptional());
+    QVERIFY(resourceSet.resource(VideoPlaybackType)->isOptional());
+    QCOMPARE(resourceSet.resources().count(), 2);
+    QCOMPARE(PlayerSet::types(), QList<ResourceType>() << AudioPlaybackType << VideoPlaybackType);
+
+    quint32 all = 0, optional = 0;
+    QVERIFY(resourceSet.fixedBitmasks(&all, &optional));
+    QVERIFY(optional != 0);
+    QVERIFY(all != optional);
+    QCOMPARE(all & optional, optional);
+
+    QList<ResourceType> granted;
+    granted << VideoPlaybackType;
+    QCOMPARE(PlayerSet::grantedTypesOf(granted), PlayerSet::allTypes);
+
+    // Changing the composition falls back to rebuilding the masks
+    resourceSet.addResource(VibraType);
+    QVERIFY(!resourceSet.fixedBitmasks(&all, &optional));
+}
+
 void TestResourceSet::testConnectToSignals()
 {
     ResourceSet resourceSet("player");
@@ -333,8 +471,9 @@ void TestResourceSet::testConnectToSignals()
     QVERIFY(signalConnectionSucceeded);
 }
 
-void TestResourceSet::handleResourcesBecameAvailable(const QList<ResourcePolicy::ResourceType> &)
+void TestResourceSet::handleResourcesBecameAvailable(const QList<ResourcePolicy::ResourceType> &availableResources)
 {
+    advisedResources = availableResources;
 }
 
 void TestResourceSet::handleResourcesGranted(const QList<ResourcePolicy::ResourceType> &)
@@ -505,4 +644,49 @@ void TestResourceSet::testUninitializedRelease()
     QCOMPARE(stateSpy.count(), 0);
 }
 
+// Changes the composition of a thread-safe set from another thread, with
+// requests in between.
+class CompositionThread: public QThread
+{
+public:
+    CompositionThread(ResourceSet *resourceSet) : resourceSet(resourceSet) {}
+
+protected:
+    void run()
+    {
+        resourceSet->addResource(VideoPlaybackType);
+        resourceSet->release();
+        resourceSet->deleteResource(AudioPlaybackType);
+        resourceSet->addResourceObject(new AudioRecorderResource);
+        resourceSet->update();
+        resourceSet->deleteResource(VideoPlaybackType);
+    }
+
+private:
+    ResourceSet *resourceSet;
+};
+
+void TestResourceSet::testThreadSafeComposition()
+{
+    ResourceSet resourceSet("player");
+    QVERIFY(resourceSet.setThreadSafe());
+    resourceSet.addResource(AudioPlaybackType);
+
+    CompositionThread worker(&resourceSet);
+    worker.start();
+    QVERIFY(worker.wait(5000));
+
+    // Nothing changes before the set's own thread gets to the calls
+    QVERIFY(resourceSet.contains(AudioPlaybackType));
+    QVERIFY(!resourceSet.contains(VideoPlaybackType));
+    QVERIFY(!resourceSet.contains(AudioRecorderType));
+
+    QCoreApplication::processEvents();
+
+    // The video resource was added before it was deleted
+    QVERIFY(!resourceSet.contains(AudioPlaybackType));
+    QVERIFY(!resourceSet.contains(VideoPlaybackType));
+    QVERIFY(resourceSet.contains(AudioRecorderType));
+}
+
 QTEST_MAIN(TestResourceSet)
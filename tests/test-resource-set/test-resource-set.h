@@ -26,6 +26,7 @@ USA.
 #include <QList>
 #include <QtTest/QTest>
 #include <policy/resource-set.h>
+#include <policy/static-resource-set.h>
 
 class TestResourceSet: public QObject
 {
@@ -35,6 +36,8 @@ private:
 
     void waitForSignal(const QObject *sender, const char *signal, quint32 timeout = 1000);
 
+    QList<ResourcePolicy::ResourceType> advisedResources;
+
 public:
     TestResourceSet();
     ~TestResourceSet();
@@ -70,6 +73,11 @@ private slots:
     void testSetAutoReleaseNoInit();
     void testSetAlwaysReply();
     void testSetAlwaysReplyNoInit();
+    void testAdviceResources();
+    void testAdviceDelivery();
+    void testRequestTimeout();
+    void testSetLazy();
+    void testStaticResourceSet();
 
     void testConnectToSignals();
 
@@ -82,6 +90,8 @@ private slots:
     void testUpdateNoInit();
 
     void testUninitializedRelease();
+
+    void testThreadSafeComposition();
 };
 
 #endif
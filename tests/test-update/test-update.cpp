@@ -165,4 +165,69 @@ void TestUpdate::testUpdateGranted()
     QCOMPARE(stateSpyBecameAvailable.count(), 2);
 }
 
+// An update that changes nothing is acknowledged before update() returns,
+// no event loop needed.
+void TestUpdate::testUpdateUnchanged()
+{
+    ResourceSet resourceSet("player");
+    QVERIFY(resourceSet.setAlwaysReply());
+
+    QSignalSpy stateSpyUpdateOK(&resourceSet, SIGNAL(updateOK()));
+    QVERIFY(stateSpyUpdateOK.isValid());
+
+    bool addOk = resourceSet.addResource(AudioPlaybackType);
+    QVERIFY(addOk);
+    bool connectOk = resourceSet.initAndConnect();
+    QVERIFY(connectOk);
+    waitForSignal(&resourceSet, SIGNAL(managerIsUp()));
+
+    bool updateOk = resourceSet.update();
+    QVERIFY(updateOk);
+    QCOMPARE(stateSpyUpdateOK.count(), 1);
+
+    updateOk = resourceSet.update();
+    QVERIFY(updateOk);
+    QCOMPARE(stateSpyUpdateOK.count(), 2);
+}
+
+// A set holding resources is answered by the manager, with a grant, even
+// if the update changes nothing.
+void TestUpdate::testUpdateUnchangedGranted()
+{
+    ResourceSet resourceSet("player");
+    QVERIFY(resourceSet.setAlwaysReply());
+
+    QSignalSpy stateSpyGranted(&resourceSet,
+            SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+    QVERIFY(stateSpyGranted.isValid());
+    QSignalSpy stateSpyUpdateOK(&resourceSet, SIGNAL(updateOK()));
+    QVERIFY(stateSpyUpdateOK.isValid());
+    QSignalSpy stateSpyReleased(&resourceSet, SIGNAL(resourcesReleased()));
+    QVERIFY(stateSpyReleased.isValid());
+
+    bool addOk = resourceSet.addResource(AudioPlaybackType);
+    QVERIFY(addOk);
+    bool connectOk = resourceSet.initAndConnect();
+    QVERIFY(connectOk);
+
+    bool acquireOk = resourceSet.acquire();
+    QVERIFY(acquireOk);
+    waitForSignal(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+    QCOMPARE(stateSpyGranted.count(), 1);
+
+    bool updateOk = resourceSet.update();
+    QVERIFY(updateOk);
+    QCOMPARE(stateSpyUpdateOK.count(), 0);
+    waitForSignal(&resourceSet, SIGNAL(resourcesGranted(const QList<ResourcePolicy::ResourceType> &)));
+
+    QCOMPARE(stateSpyGranted.count(), 2);
+    QCOMPARE(stateSpyUpdateOK.count(), 0);
+
+    // The update retired from the queue, the release goes out
+    bool releaseOk = resourceSet.release();
+    QVERIFY(releaseOk);
+    waitForSignal(&resourceSet, SIGNAL(resourcesReleased()));
+    QCOMPARE(stateSpyReleased.count(), 1);
+}
+
 QTEST_MAIN(TestUpdate)
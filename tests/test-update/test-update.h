@@ -41,6 +41,8 @@ private slots:
 
     void testUpdate();
     void testUpdateGranted();
+    void testUpdateUnchanged();
+    void testUpdateUnchangedGranted();
 };
 
 #endif
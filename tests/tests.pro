@@ -32,7 +32,11 @@ SUBDIRS = test-audio-resource               \
           test-auto-release                 \
           test-always-reply                 \
           test-looping                      \
-          test-released-by-manager
+          test-released-by-manager          \
+          test-memory-leaks                 \
+          test-allocations                  \
+          benchmark-dbus-eventloop          \
+          test-idle-wakeups
 
 # Install options
 include(test_common.pri)